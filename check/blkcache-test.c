@@ -0,0 +1,515 @@
+/* file: blkcache-test.c	B. Moody	18 October 2026
+
+Test of the LightWAVE server's cache of remote signal files
+Copyright (C) 2026 Benjamin Moody
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+This program starts a minimal HTTP server on the loopback interface,
+serving files from a temporary directory, and reads those files through
+blkcache.c, checking both the bytes returned and the requests that were
+made for them.  A file is served with range requests honored if its URL
+begins with /r/, or as a server that ignores the Range header would
+serve it (sending the whole file with status 200) if its URL begins with
+/f/.  The server gives each file an ETag made from its size and
+modification time, and writes a line describing each request to a log
+file, which the tests read to see what was requested.
+
+The tests check that:
+  - a read from a file fetches the blocks it needs, and the following
+    ones, with one range request, and later reads of those blocks are
+    answered from the cache;
+  - a read from a file whose server ignores the Range header is
+    answered correctly, and caches the whole file;
+  - once a file's information is out of date, blkcache_open() checks
+    it with a HEAD request; the cached blocks are used again if the
+    file is unchanged, and fetched again if it has changed;
+  - when the cache is full, the least recently used blocks are removed.
+
+Usage: blkcache-test
+The exit status is 0 if every test passes.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "blkcache.h"
+
+static char dir[] = "/tmp/lw-blkcache-XXXXXX";	/* files served */
+static char cache[sizeof(dir) + 6];		/* the cache directory */
+static char log_name[sizeof(dir) + 4];		/* the server's log */
+static int port;
+static int failures;
+
+/* Answer one HTTP request on a connection. */
+static void serve(int fd)
+{
+    char req[4096], method[16], path[256], name[512], hdr[512], *p;
+    unsigned char *data = NULL;
+    long long a = -1, b = -1, size;
+    struct stat st;
+    size_t n = 0;
+    ssize_t k;
+    FILE *f;
+    int range, status;
+
+    while (n < sizeof(req) - 1
+           && (k = read(fd, req + n, sizeof(req) - 1 - n)) > 0) {
+        req[n += k] = '\0';
+        if (strstr(req, "\r\n\r\n"))
+            break;
+    }
+    req[n] = '\0';
+    if (sscanf(req, "%15s %255s", method, path) != 2)
+        return;
+    if ((p = strstr(req, "\nRange: bytes=")) != NULL)
+        sscanf(p + 14, "%lld-%lld", &a, &b);
+    if ((f = fopen(log_name, "a")) != NULL) {
+        fprintf(f, "%s %s %lld-%lld\n", method, path, a, b);
+        fclose(f);
+    }
+
+    range = (strncmp(path, "/r/", 3) == 0);
+    sprintf(name, "%s/%s", dir, path + 3);
+    if ((!range && strncmp(path, "/f/", 3) != 0) || stat(name, &st) != 0
+        || (f = fopen(name, "rb")) == NULL) {
+        k = sprintf(hdr, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n"
+                    "Connection: close\r\n\r\n");
+        write(fd, hdr, k);
+        return;
+    }
+    size = st.st_size;
+    if ((data = malloc(size + 1)) == NULL
+        || fread(data, 1, size, f) != (size_t) size) {
+        fclose(f);
+        free(data);
+        return;
+    }
+    fclose(f);
+    if (range && a >= 0 && a < size) {
+        if (b < a || b >= size)
+            b = size - 1;
+        status = 206;
+    }
+    else {
+        a = 0;
+        b = size - 1;
+        status = 200;
+    }
+    k = sprintf(hdr, "HTTP/1.1 %d %s\r\nContent-Length: %lld\r\n"
+                "ETag: \"%lld-%ld\"\r\nConnection: close\r\n",
+                status, status == 206 ? "Partial Content" : "OK",
+                b - a + 1, size, (long) st.st_mtime);
+    if (status == 206)
+        k += sprintf(hdr + k, "Content-Range: bytes %lld-%lld/%lld\r\n",
+                     a, b, size);
+    k += sprintf(hdr + k, "\r\n");
+    if (write(fd, hdr, k) == k && strcmp(method, "GET") == 0)
+        write(fd, data + a, b - a + 1);
+    free(data);
+}
+
+/* Start the server in a child process.  Returns its process ID. */
+static pid_t start_server(void)
+{
+    struct sockaddr_in sa;
+    socklen_t len = sizeof(sa);
+    pid_t pid;
+    int s, fd, on = 1;
+
+    if ((s = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        return -1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(s, (struct sockaddr *) &sa, sizeof(sa)) != 0
+        || listen(s, 16) != 0
+        || getsockname(s, (struct sockaddr *) &sa, &len) != 0) {
+        close(s);
+        return -1;
+    }
+    port = ntohs(sa.sin_port);
+    if ((pid = fork()) == 0) {
+        signal(SIGPIPE, SIG_IGN);   /* the client may stop reading */
+        while ((fd = accept(s, NULL, NULL)) >= 0) {
+            serve(fd);
+            close(fd);
+        }
+        _exit(0);
+    }
+    close(s);
+    return pid;
+}
+
+/* Return the byte at offset i of version v of a test file. */
+static unsigned char content(int v, long long i)
+{
+    return (unsigned char) ((i * 7 + i / 251 + v * 101) & 0xff);
+}
+
+/* Write version v of a test file, of the given size, setting its
+   modification time to mtime (so that its ETag changes). */
+static void write_test_file(const char *name, int v, long long size,
+                            time_t mtime)
+{
+    char path[512];
+    struct utimbuf ut;
+    long long i;
+    FILE *f;
+
+    sprintf(path, "%s/%s", dir, name);
+    if ((f = fopen(path, "wb")) == NULL) {
+        perror(path);
+        exit(1);
+    }
+    for (i = 0; i < size; i++)
+        putc(content(v, i), f);
+    fclose(f);
+    ut.actime = ut.modtime = mtime;
+    utime(path, &ut);
+}
+
+/* Return the number of requests the server has logged so far, and copy
+   the last one into last (if it isn't NULL). */
+static int requests(char *last, size_t size)
+{
+    char line[1024];
+    FILE *f;
+    int n = 0;
+
+    if (last)
+        last[0] = '\0';
+    if ((f = fopen(log_name, "r")) == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), f)) {
+        n++;
+        if (last)
+            snprintf(last, size, "%.*s", (int) strcspn(line, "\n"), line);
+    }
+    fclose(f);
+    return n;
+}
+
+static void check(int ok, const char *what)
+{
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        failures++;
+    }
+}
+
+/* Open a test file through the cache. */
+static BLKFILE *open_file(const char *prefix, const char *name)
+{
+    char url[256];
+
+    sprintf(url, "http://127.0.0.1:%d/%s/%s", port, prefix, name);
+    return blkcache_open(url);
+}
+
+/* Read len bytes of a file, beginning at off, and check that they are
+   the bytes of version v.  Returns the number of requests made. */
+static int read_check(BLKFILE *f, int v, long long off, size_t len,
+                      const char *what)
+{
+    unsigned char *buf = malloc(len);
+    int n = requests(NULL, 0), ok;
+    size_t i;
+
+    ok = (buf && blkcache_read(f, off, buf, len) == 0);
+    for (i = 0; ok && i < len; i++)
+        ok = (buf[i] == content(v, off + i));
+    check(ok, what);
+    free(buf);
+    return requests(NULL, 0) - n;
+}
+
+/* Make the saved information about every file out of date, by setting
+   the time at which it was checked (the second number on the third line;
+   see blkcache.c) to long ago. */
+static void expire_info(void)
+{
+    char path[512], line[4][1024];
+    struct dirent *e;
+    long long size, checked;
+    DIR *d;
+    FILE *f;
+    int i;
+
+    if ((d = opendir(cache)) == NULL)
+        return;
+    while ((e = readdir(d)) != NULL) {
+        if (e->d_name[0] != 'i')
+            continue;
+        sprintf(path, "%s/%s", cache, e->d_name);
+        if ((f = fopen(path, "r")) == NULL)
+            continue;
+        for (i = 0; i < 4 && fgets(line[i], sizeof(line[i]), f); i++)
+            ;
+        fclose(f);
+        if (i == 4 && sscanf(line[2], "%lld %lld", &size, &checked) == 2
+            && (f = fopen(path, "w")) != NULL) {
+            fprintf(f, "%s%s%lld 1\n%s", line[0], line[1], size, line[3]);
+            fclose(f);
+        }
+    }
+    closedir(d);
+}
+
+/* Return the number of blocks in the cache. */
+static int cached_blocks(void)
+{
+    struct dirent *e;
+    DIR *d;
+    int n = 0;
+
+    if ((d = opendir(cache)) == NULL)
+        return 0;
+    while ((e = readdir(d)) != NULL)
+        if (e->d_name[0] == 'b')
+            n++;
+    closedir(d);
+    return n;
+}
+
+/* Move the modification time (and so the time of last use) of every
+   block in the cache back by the given number of seconds. */
+static void age_blocks(int seconds)
+{
+    char path[512];
+    struct utimbuf ut;
+    struct stat st;
+    struct dirent *e;
+    DIR *d;
+
+    if ((d = opendir(cache)) == NULL)
+        return;
+    while ((e = readdir(d)) != NULL)
+        if (e->d_name[0] == 'b') {
+            sprintf(path, "%s/%s", cache, e->d_name);
+            if (stat(path, &st) == 0) {
+                ut.actime = ut.modtime = st.st_mtime - seconds;
+                utime(path, &ut);
+            }
+        }
+    closedir(d);
+}
+
+/* Remove the files in a directory, and the directory. */
+static void remove_dir(const char *name)
+{
+    char path[512];
+    struct dirent *e;
+    DIR *d;
+
+    if ((d = opendir(name)) == NULL)
+        return;
+    while ((e = readdir(d)) != NULL)
+        if (e->d_name[0] != '.') {
+            sprintf(path, "%s/%s", name, e->d_name);
+            unlink(path);
+        }
+    closedir(d);
+    rmdir(name);
+}
+
+#define B	BLKCACHE_BLOCK
+
+/* Range requests: a read fetches the blocks it needs and the following
+   ones, up to BLKCACHE_FETCH blocks, stopping at a cached block. */
+static void test_ranges(void)
+{
+    long long size = (BLKCACHE_FETCH + 5) * (long long) B - 123;
+    char last[1024], want[1024];
+    BLKFILE *f;
+
+    write_test_file("ranges", 0, size, 1000000000);
+    if ((f = open_file("r", "ranges")) == NULL) {
+        check(0, "open a file (range requests)");
+        return;
+    }
+    check(blkcache_size(f) == size, "size of a file (range requests)");
+
+    check(read_check(f, 0, 5 * B + 100, 1000, "read within a block") == 1,
+          "one request for a read within a block");
+    requests(last, sizeof(last));
+    sprintf(want, "GET /r/ranges %lld-%lld", 5LL * B, size - 1);
+    check(strcmp(last, want) == 0, "range requested for the following blocks");
+
+    check(read_check(f, 0, 10 * B - 10, 20, "read across blocks") == 0,
+          "no request for cached blocks");
+    check(read_check(f, 0, size - 200, 200, "read at the end") == 0,
+          "no request for the cached end of the file");
+
+    check(read_check(f, 0, B / 2, 3 * B, "read before cached blocks") == 1,
+          "one request for blocks before cached ones");
+    requests(last, sizeof(last));
+    sprintf(want, "GET /r/ranges %lld-%lld", 0LL, 5LL * B - 1);
+    check(strcmp(last, want) == 0, "range requested up to the cached blocks");
+    blkcache_close(f);
+}
+
+/* A server that ignores the Range header: the whole file is sent, and
+   all of it is cached. */
+static void test_full(void)
+{
+    long long size = 3 * (long long) B + 1000;
+    BLKFILE *f;
+
+    write_test_file("full", 1, size, 1000000000);
+    if ((f = open_file("f", "full")) == NULL) {
+        check(0, "open a file (range ignored)");
+        return;
+    }
+    check(read_check(f, 1, 2 * B + 10, 500, "read with range ignored") == 1,
+          "one request with range ignored");
+    check(read_check(f, 1, 0, size, "read all with range ignored") == 0,
+          "whole file cached with range ignored");
+    blkcache_close(f);
+}
+
+/* Revalidation: a file whose information is out of date is checked with
+   a HEAD request when it is opened; its cached blocks are used if it is
+   unchanged, and fetched again if it has changed. */
+static void test_revalidate(void)
+{
+    long long size = 2 * (long long) B;
+    char last[1024];
+    BLKFILE *f;
+    int n;
+
+    write_test_file("reval", 2, size, 1000000000);
+    if ((f = open_file("r", "reval")) == NULL) {
+        check(0, "open a file (revalidation)");
+        return;
+    }
+    read_check(f, 2, 0, size, "read before revalidation");
+    blkcache_close(f);
+
+    n = requests(NULL, 0);
+    f = open_file("r", "reval");
+    check(f && requests(NULL, 0) == n, "no HEAD request while up to date");
+    blkcache_close(f);
+
+    expire_info();
+    f = open_file("r", "reval");
+    check(f && requests(last, sizeof(last)) == n + 1
+          && strncmp(last, "HEAD ", 5) == 0, "HEAD request when out of date");
+    if (f)
+        check(read_check(f, 2, 0, size, "read unchanged file") == 0,
+              "no request for an unchanged file");
+    blkcache_close(f);
+
+    write_test_file("reval", 3, size, 1000000100);
+    expire_info();
+    if ((f = open_file("r", "reval")) == NULL) {
+        check(0, "open a changed file");
+        return;
+    }
+    check(read_check(f, 3, 0, size, "read changed file") == 1,
+          "one request for a changed file");
+    blkcache_close(f);
+}
+
+/* Eviction: when the blocks exceed the limit, the least recently used
+   are removed. */
+static void test_eviction(void)
+{
+    long long size = 4 * (long long) B;
+    BLKFILE *a, *b, *c;
+
+    remove_dir(cache);
+    if (mkdir(cache, 0700) != 0 || blkcache_init(cache, 10 * B) != 0) {
+        check(0, "make a small cache");
+        return;
+    }
+    write_test_file("lru-a", 4, size, 1000000000);
+    write_test_file("lru-b", 5, size, 1000000000);
+    write_test_file("lru-c", 6, size, 1000000000);
+    a = open_file("r", "lru-a");
+    b = open_file("r", "lru-b");
+    c = open_file("r", "lru-c");
+    if (a == NULL || b == NULL || c == NULL) {
+        check(0, "open files (eviction)");
+        return;
+    }
+    /* Read the first file, then the second, so that the first file's
+       blocks are the oldest; then use them again, and go over the
+       limit. */
+    read_check(a, 4, 0, size, "read first file");
+    age_blocks(1000);
+    read_check(b, 5, 0, size, "read second file");
+    age_blocks(1000);
+    check(cached_blocks() == 8, "blocks cached below the limit");
+    check(read_check(a, 4, 0, size, "read first file again") == 0,
+          "first file still cached");
+    read_check(c, 6, 0, size, "read third file");
+    check(cached_blocks() <= 10, "blocks removed when over the limit");
+    check(read_check(a, 4, 0, size, "read recently used file") == 0,
+          "recently used blocks kept");
+    check(read_check(c, 6, 0, size, "read newest file") == 0,
+          "newest blocks kept");
+    check(read_check(b, 5, 0, size, "read least recently used file") == 1,
+          "least recently used blocks removed");
+    blkcache_close(a);
+    blkcache_close(b);
+    blkcache_close(c);
+}
+
+int main(void)
+{
+    pid_t server;
+
+    if (mkdtemp(dir) == NULL) {
+        perror("blkcache-test");
+        return 1;
+    }
+    sprintf(cache, "%s/cache", dir);
+    sprintf(log_name, "%s/log", dir);
+    if (mkdir(cache, 0700) != 0 || blkcache_init(cache, 1024L * B) != 0
+        || (server = start_server()) < 0) {
+        perror("blkcache-test");
+        remove_dir(dir);
+        return 1;
+    }
+
+    test_ranges();
+    test_full();
+    test_revalidate();
+    test_eviction();
+
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    remove_dir(cache);
+    remove_dir(dir);
+    if (failures) {
+        printf("The block cache failed %d test%s.\n", failures,
+               failures == 1 ? "" : "s");
+        return 1;
+    }
+    printf("The block cache fetches and caches remote files properly.\n");
+    return 0;
+}
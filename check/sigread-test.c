@@ -0,0 +1,325 @@
+/* file: sigread-test.c	B. Moody	18 October 2026
+
+Test of the LightWAVE server's direct signal file decoder
+Copyright (C) 2026 Benjamin Moody
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+This program writes a few small records, in a temporary directory, with
+signal files in formats 16, 61, 80, and 212 filled with random bytes
+(so that every value, including the smallest value of each format,
+which the WFDB library reads as WFDB_INVALID_SAMPLE, occurs often).
+It also writes a multi-segment record with a layout segment, a null
+segment, and segments whose signals are stored in different formats and
+groups.  It reads each record from beginning to end with getframe(), and
+then checks that sigread_frames() gives the same samples for many blocks
+of frames, beginning at even and odd frames (in format 212, a frame of a
+group with an odd number of samples can begin in the middle of a
+3-byte pair) and ending at or before the end of the record, and (in the
+multi-segment record) beginning at, ending at, or spanning the
+boundaries between segments.
+
+Usage: sigread-test
+The exit status is 0 if every block matches.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wfdb/wfdb.h>
+#include "sigread.h"
+
+#define NFRAMES	2000	/* length of each record */
+#define NBLOCKS	500	/* number of blocks read from each record */
+#define MULTI	"srseg"	/* name of the multi-segment record */
+
+/* A signal file of a test record, and its signals' samples per frame. */
+struct group {
+    int fmt;
+    int nsig;
+    int spf[3];
+};
+
+/* A test record, or a segment of the multi-segment record. */
+struct record {
+    char *name;
+    long nframes;
+    int ngroups;
+    struct group g[3];
+};
+
+static struct record records[] = {
+    { "sr16", NFRAMES, 1, { { 16, 2, { 1, 1 } } } },
+    { "sr61", NFRAMES, 1, { { 61, 2, { 2, 1 } } } },
+    { "sr80", NFRAMES, 1, { { 80, 3, { 1, 1, 1 } } } },
+    { "sr212", NFRAMES, 1, { { 212, 1, { 1 } } } }, /* frames at odd offsets */
+    { "sr212m", NFRAMES, 2, { { 212, 3, { 1, 2, 1 } },	/* likewise */
+                              { 212, 2, { 1, 1 } } } },
+    { "srmix", NFRAMES, 3, { { 212, 3, { 1, 1, 1 } },
+                             { 80, 1, { 2 } },
+                             { 16, 2, { 1, 1 } } } },
+};
+
+/* The segments of MULTI, which follow its layout segment (MULTI_0) and
+   together are NFRAMES long.  A segment without a name is a null
+   segment.  The signals of each segment are those of the first. */
+static struct record segments[] = {
+    { MULTI "_1", 700, 1, { { 212, 3, { 1, 2, 1 } } } },
+    { NULL, 300, 0 },
+    { MULTI "_2", 600, 2, { { 16, 2, { 1, 2 } },
+                            { 80, 1, { 1 } } } },
+    { MULTI "_3", 399, 1, { { 61, 3, { 1, 2, 1 } } } },
+    { MULTI "_4", 1, 1, { { 212, 3, { 1, 2, 1 } } } },
+};
+
+/* Return a random byte, favoring those that make up the smallest value
+   of each format, and the values next to it. */
+static unsigned char random_byte(void)
+{
+    static const unsigned char special[] = { 0x00, 0x80, 0x08, 0x01, 0xff };
+    int r = rand() % 16;
+
+    return (r < 5) ? special[r] : rand() & 0xff;
+}
+
+/* Write the header and signal files of a record.  Returns 0 if
+   successful, or -1 if a file couldn't be written. */
+static int write_record(const struct record *rec)
+{
+    char name[64];
+    FILE *f;
+    long bytes, i, nsamp;
+    int g, j, nsig = 0;
+
+    for (g = 0; g < rec->ngroups; g++)
+        nsig += rec->g[g].nsig;
+    sprintf(name, "%s.hea", rec->name);
+    if ((f = fopen(name, "w")) == NULL)
+        return -1;
+    fprintf(f, "%s %d 360 %ld\n", rec->name, nsig, rec->nframes);
+    for (g = nsig = 0; g < rec->ngroups; g++)
+        for (j = 0; j < rec->g[g].nsig; j++)
+            fprintf(f, "%s_%d.dat %dx%d 200 12 0 0 0 0 sig %d\n",
+                    rec->name, g, rec->g[g].fmt, rec->g[g].spf[j], nsig++);
+    if (fclose(f) != 0)
+        return -1;
+
+    for (g = 0; g < rec->ngroups; g++) {
+        for (j = 0, nsamp = 0; j < rec->g[g].nsig; j++)
+            nsamp += rec->g[g].spf[j];
+        nsamp *= rec->nframes;
+        switch (rec->g[g].fmt) {
+        case 80:  bytes = nsamp; break;
+        case 212: bytes = nsamp / 2 * 3 + (nsamp % 2) * 2; break;
+        default:  bytes = nsamp * 2; break;
+        }
+        sprintf(name, "%s_%d.dat", rec->name, g);
+        if ((f = fopen(name, "wb")) == NULL)
+            return -1;
+        for (i = 0; i < bytes; i++)
+            putc(random_byte(), f);
+        if (fclose(f) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* Write the headers and signal files of the multi-segment record MULTI.
+   Returns 0 if successful, or -1 if a file couldn't be written. */
+static int write_multi(void)
+{
+    const struct record *seg = &segments[0];
+    FILE *f;
+    long nframes = 0;
+    int g, i, j, nsig = 0, nseg = sizeof(segments) / sizeof(segments[0]);
+
+    for (i = 0; i < nseg; i++) {
+        if (segments[i].name && write_record(&segments[i]) != 0)
+            return -1;
+        nframes += segments[i].nframes;
+    }
+    for (g = 0; g < seg->ngroups; g++)
+        nsig += seg->g[g].nsig;
+
+    if ((f = fopen(MULTI "_0.hea", "w")) == NULL)
+        return -1;
+    fprintf(f, "%s_0 %d 360 0\n", MULTI, nsig);
+    for (g = nsig = 0; g < seg->ngroups; g++)
+        for (j = 0; j < seg->g[g].nsig; j++)
+            fprintf(f, "~ 0x%d 200 12 0 0 0 0 sig %d\n",
+                    seg->g[g].spf[j], nsig++);
+    if (fclose(f) != 0)
+        return -1;
+
+    if ((f = fopen(MULTI ".hea", "w")) == NULL)
+        return -1;
+    fprintf(f, "%s/%d %d 360 %ld\n%s_0 0\n", MULTI, nseg + 1, nsig,
+            nframes, MULTI);
+    for (i = 0; i < nseg; i++)
+        fprintf(f, "%s %ld\n", segments[i].name ? segments[i].name : "~",
+                segments[i].nframes);
+    return (fclose(f) == 0) ? 0 : -1;
+}
+
+/* Remove the header and signal files of a record. */
+static void remove_record(const struct record *rec)
+{
+    char name[64];
+    int g;
+
+    sprintf(name, "%s.hea", rec->name);
+    unlink(name);
+    for (g = 0; g < rec->ngroups; g++) {
+        sprintf(name, "%s_%d.dat", rec->name, g);
+        unlink(name);
+    }
+}
+
+/* Check one record, whose segments (if it is a multi-segment record) are
+   seg[0] to seg[nseg-1].  Returns the number of mismatches found. */
+static int check_record(const char *name, const struct record *seg,
+                        int nseg)
+{
+    WFDB_Siginfo *s;
+    WFDB_Sample *ref, *v;
+    SIGREAD *r;
+    char **path, *p;
+    long framelen, i, k, n, b, got, want, errors = 0;
+    WFDB_Time t;
+    int nsig;
+
+    if ((nsig = isigopen((char *) name, NULL, 0)) < 1) {
+        fprintf(stderr, "%s: can't read header\n", name);
+        return 1;
+    }
+    if ((s = malloc(nsig * sizeof(WFDB_Siginfo))) == NULL
+        || (path = malloc(nsig * sizeof(char *))) == NULL
+        || isigopen((char *) name, s, nsig) != nsig) {
+        fprintf(stderr, "%s: can't open signals\n", name);
+        return 1;
+    }
+    for (i = framelen = 0; i < nsig; i++) {
+        framelen += s[i].spf;
+        p = wfdbfile(s[i].fname, NULL);
+        path[i] = p ? strdup(p) : NULL;
+    }
+    if ((ref = malloc(NFRAMES * framelen * sizeof(WFDB_Sample)))
+        == NULL || (v = malloc(NFRAMES * framelen * sizeof(WFDB_Sample)))
+        == NULL) {
+        fprintf(stderr, "insufficient memory\n");
+        exit(1);
+    }
+    for (n = 0; n < NFRAMES && getframe(ref + n * framelen) > 0; n++)
+        ;
+    if (n != NFRAMES) {
+        fprintf(stderr, "%s: getframe read only %ld frames\n", name, n);
+        return 1;
+    }
+
+    if ((r = sigread_open(wfdbfile("hea", (char *) name), s, nsig, path))
+        == NULL) {
+        fprintf(stderr, "%s: sigread_open failed\n", name);
+        return 1;
+    }
+    for (k = 0; k < NBLOCKS && errors < 10; k++) {
+        t = (k < 4) ? k : rand() % (NFRAMES + 2);
+        n = (k % 3 == 0) ? NFRAMES : 1 + rand() % 300;
+
+        /* In a multi-segment record, every other block begins at, ends
+           at, or spans the beginning of a segment (or the end of the
+           record). */
+        if (nseg > 0 && k % 2 == 1) {
+            for (i = rand() % (nseg + 1), b = 0; i > 0; i--)
+                b += seg[i-1].nframes;
+            n = 1 + rand() % 300;
+            switch (rand() % 3) {
+            case 0:  t = b; break;
+            case 1:  t = (b > n) ? b - n : 0; break;
+            default: t = (b > n / 2) ? b - n / 2 : 0; n++; break;
+            }
+        }
+        want = (t >= NFRAMES) ? 0 : (n < NFRAMES - t) ? n : NFRAMES - t;
+        if ((got = sigread_frames(r, t, n, v)) != want) {
+            fprintf(stderr, "%s: read %ld frames at %ld, expected %ld\n",
+                    name, got, (long) t, want);
+            errors++;
+            continue;
+        }
+        for (i = 0; i < got * framelen; i++)
+            if (v[i] != ref[t * framelen + i]) {
+                fprintf(stderr, "%s: frame %ld, sample %ld: %d, expected %d\n",
+                        name, (long) t + i / framelen, i % framelen,
+                        v[i], ref[t * framelen + i]);
+                errors++;
+                break;
+            }
+    }
+    sigread_close(r);
+    wfdbquit();
+    for (i = 0; i < nsig; i++)
+        free(path[i]);
+    free(path);
+    free(s);
+    free(ref);
+    free(v);
+    return errors;
+}
+
+int main(void)
+{
+    char dir[] = "/tmp/lw-sigread-XXXXXX";
+    int errors = 0, i, nrec = sizeof(records) / sizeof(records[0]),
+        nseg = sizeof(segments) / sizeof(segments[0]);
+
+    srand(1);
+    if (mkdtemp(dir) == NULL || chdir(dir) != 0) {
+        perror("sigread-test");
+        return 1;
+    }
+    for (i = 0; i < nrec; i++) {
+        setwfdb(dir);
+        if (write_record(&records[i]) != 0) {
+            fprintf(stderr, "%s: can't write record\n", records[i].name);
+            errors++;
+        }
+        else
+            errors += check_record(records[i].name, NULL, 0);
+    }
+    setwfdb(dir);
+    if (write_multi() != 0) {
+        fprintf(stderr, "%s: can't write record\n", MULTI);
+        errors++;
+    }
+    else
+        errors += check_record(MULTI, segments, nseg);
+
+    for (i = 0; i < nrec; i++)
+        remove_record(&records[i]);
+    for (i = 0; i < nseg; i++)
+        if (segments[i].name)
+            remove_record(&segments[i]);
+    unlink(MULTI ".hea");
+    unlink(MULTI "_0.hea");
+    if (chdir("/") == 0)
+        rmdir(dir);
+    if (errors) {
+        printf("sigread decodes some signal files differently from the"
+               " WFDB library.\n");
+        return 1;
+    }
+    printf("sigread decodes signal files in formats 16, 61, 80, and 212,"
+           " and multi-segment\nrecords, as the WFDB library does.\n");
+    return 0;
+}
@@ -61,6 +61,8 @@ var server,
     ann_set = [], // annotators for the selected database, from alist()
     ann = [],   // annotations read and cached by read_annotations()
     nann = 0,	// number of annotators, set by read_annotations()
+    ann_page = 20000, // annotations per annotator in each part of a read
+    rlist_page = 1000, // records listed at once by rlist()
     annselected = '',// name of annotation set to be highlighted, if any
     selarr = null, // array of annotations selected for search/edit
     selann = -1,// index of selected annotation in selarr, if any
@@ -240,11 +242,12 @@ function set_trace(db, record, s) {
     s.record = record;
     s.tf = s.t0 + len*s.tps;
 
-    // restore amplitudes from first differences sent by server
+    // restore amplitudes from first differences sent by server (unless
+    // they were sent as they are, in a binary response)
     v = s.samp;
     vmean = vmax = vmin = v[0];
     for (j = ni = p = 0; j < len; j++) {
-	p = v[j] += p;
+	p = s.raw ? v[j] : (v[j] += p);
 	// ignore invalid samples in baseline calculation
 	if (p === -32768) { ni++; }
 	else {
@@ -338,15 +341,137 @@ function html_escape(s) {
 }
 
 // Request JSONP data (equivalent to '$.getJSON' minus the
-// anti-caching and anti-cross-domain options)
-function get_jsonp(url, callback) {
+// anti-caching and anti-cross-domain options); if the request fails,
+// failed() is called instead of callback(), if given
+function get_jsonp(url, callback, failed) {
     $.ajax({ dataType: "json",
              url: url,
              success: callback,
+             error: failed,
              cache: true,
              crossDomain: true });
 }
 
+// Decode a binary response to a fetch request (see bin_signal() in the
+// server's lightwave.c), returning an object like the one obtained from
+// the JSON response.  Samples sent as varints are returned as first
+// differences, as in the JSON response; raw samples are returned as typed
+// arrays that share the response buffer, and the signal's 'raw' property
+// is set.
+function decode_fetch(buf) {
+    var a, b, count, d, enc, h, i, j, k, n, narr, nbytes, nlen, o, s, sig = [],
+        tpb, ulen, v, x, z;
+
+    // read a 64-bit signed integer (exact if less than 2^53 in magnitude)
+    function int64(o) {
+	return d.getUint32(o, true) + d.getInt32(o + 4, true) * 4294967296;
+    }
+
+    // read a UTF-8 string
+    function text(o, len) {
+	var t = '';
+	for (k = 0; k < len; k++) { t += String.fromCharCode(b[o + k]); }
+	try { return decodeURIComponent(escape(t)); }
+	catch (e) { return t; }
+    }
+
+    d = new DataView(buf);
+    b = new Uint8Array(buf);
+    n = d.getUint32(4, true);
+    for (i = 0, h = 8; i < n; i++) {
+	s = { t0: int64(h),
+	      tf: int64(h + 8),
+	      gain: d.getFloat64(h + 16, true),
+	      scale: d.getFloat64(h + 24, true),
+	      base: d.getInt32(h + 32, true),
+	      tps: d.getInt32(h + 36, true) };
+	tpb = d.getInt32(h + 40, true);
+	count = d.getUint32(h + 44, true);
+	nbytes = d.getUint32(h + 48, true);
+	enc = b[h + 52];
+	narr = b[h + 53];
+	nlen = d.getUint16(h + 54, true);
+	ulen = d.getUint16(h + 56, true);
+	s.name = text(h + 60, nlen);
+	s.units = text(h + 60 + nlen, ulen);
+	o = h + 60 + nlen + ulen;
+	o += (4 - o % 4) % 4;
+	h = o + nbytes;		// start of the next signal's header
+	h += (4 - h % 4) % 4;
+	for (j = 0, a = []; j < narr; j++) {
+	    if (enc === 1) { v = new Int16Array(buf, o, count); o += 2*count; }
+	    else if (enc === 2) { v = new Int32Array(buf, o, count); o += 4*count; }
+	    else {	// first differences, as zigzag varints
+		v = new Int32Array(count);
+		for (k = 0; k < count; k++) {
+		    z = x = 0;
+		    do { z += (b[o] & 0x7f) * Math.pow(2, x); x += 7; }
+		    while (b[o++] & 0x80);
+		    v[k] = (z % 2) ? -(z + 1)/2 : z/2;
+		}
+	    }
+	    a.push(v);
+	}
+	s.raw = (enc !== 3);
+	if (narr === 1) { s.samp = a[0]; }
+	else {	// envelopes
+	    s.tpb = tpb;
+	    s.min = a[0];
+	    s.max = a[1];
+	    if (narr > 2) { s.mean = a[2]; }
+	}
+	sig.push(s);
+    }
+    return { fetch: sig.length ? { signal: sig } : null, success: true };
+}
+
+// Return true if url has the same origin as this page.
+function same_origin(url) {
+    var a = document.createElement('a');
+
+    a.href = url;
+    return a.protocol === window.location.protocol
+	&& a.host === window.location.host;
+}
+
+// Request signals in binary form (see decode_fetch()), if the browser
+// supports typed arrays.  A server that doesn't support the binary format
+// sends JSON instead.  The request can't be made by JSONP, and the server
+// sends no CORS headers, so a server on another origin (or a failed binary
+// request) is asked for JSONP as before.
+function get_fetch(url, callback) {
+    var xhr;
+
+    if (typeof ArrayBuffer === 'undefined' || typeof DataView === 'undefined'
+	|| !same_origin(url)) {
+	get_jsonp(url, callback);
+	return;
+    }
+    xhr = new XMLHttpRequest();
+    xhr.open('GET', url + '&format=binary', true);
+    xhr.responseType = 'arraybuffer';
+    xhr.onerror = function() { get_jsonp(url, callback); };
+    xhr.onload = function() {
+	var b = new Uint8Array(xhr.response), i, t = '';
+
+	if (xhr.status !== 200) {
+	    get_jsonp(url, callback);
+	    return;
+	}
+	if (b.length >= 8 && String.fromCharCode(b[0], b[1], b[2], b[3])
+	    === 'LWB1') {
+	    callback(decode_fetch(xhr.response));
+	}
+	else {
+	    for (i = 0; i < b.length; i += 4096) {
+		t += String.fromCharCode.apply(null, b.subarray(i, i + 4096));
+	    }
+	    callback(JSON.parse(decodeURIComponent(escape(t))));
+	}
+    };
+    xhr.send();
+}
+
 // Update the summary on the Tables tab
 function show_summary() {
     var i, ia, ii, is, itext = '', rdurstr, s;
@@ -628,10 +753,15 @@ function alist() {
 }
 
 // Load the list of records in the selected database, and set up an event
-// handler for record selection.
-function rlist() {
+// handler for record selection.  Only the first rlist_page records (whose
+// names begin with prefix, if it is given) are listed; if there are more,
+// a text box lets the user narrow the list by typing a prefix.
+function rlist(prefix) {
     var i, rlist_text = '';
-    url = server + '?action=rlist&db=' + db + server_flags;
+    if (!prefix) { prefix = ''; }
+    url = server + '?action=rlist&db=' + db + '&limit=' + rlist_page
+	+ (prefix ? '&prefix=' + encodeURIComponent(prefix) : '')
+	+ server_flags;
     $('#rlname').empty();
     $('#rlist').html('Reading list of records in ' + sdb);
     $('#rslist').empty();
@@ -645,11 +775,21 @@ function rlist() {
 		    + '\">' + data.record[i] + '</option>\n';
 	    }
 	    rlist_text += '</select>';
+	    if (prefix || data.total > data.record.length) {
+		rlist_text += ' Names beginning with: '
+		    + '<input type="text" name="rprefix" size="10"> ('
+		    + data.record.length + ' of ' + data.total + ' shown)';
+	    }
 	}
 	$('#rlname').html("Record:");
 	$('#rlist').html(rlist_text);
+	$('[name=rprefix]').val(prefix);
 	// fetch the list of signals when the user selects a record
 	$('[name=record]').on("change", newrec);
+	// list the records beginning with a new prefix when it is entered
+	$('[name=rprefix]').on("change", function() {
+	    rlist($(this).val());
+	});
 	show_status(false);
     });
 }
@@ -725,8 +865,119 @@ function dblist() {
 
 // Retrieve one or more complete annotation files for the selected record
 //  If pending edits exist in local storage, merge them
+// Convert an annotator received in the columnar layout (requested using
+// layout=columns) into the usual form, with an 'annotation' array of
+// objects.  An annotator that already has that form (as sent by a server
+// that doesn't support the columnar layout) is returned unchanged.
+function expand_columns(a) {
+    var col = a.columns, i, k, len, s, t = 0, x = [];
+
+    if (!col) { return a; }
+    len = col.t.length;
+    for (i = 0; i < len; i++) {
+	t += col.t[i];
+	x[i] = { t: t, a: col.mnemonic[col.a[i]], s: 0, c: 0, n: 0, x: null };
+    }
+    s = ['s', 'c', 'n', 'x'];
+    for (k = 0; k < s.length; k++) {
+	for (i = 0; i < col[s[k]].i.length; i++) {
+	    x[col[s[k]].i[i]][s[k]] = col[s[k]].v[i];
+	}
+    }
+    a.annotation = x;
+    delete a.columns;
+    return a;
+}
+
+// Read the rest of the annotations for the current record, ann_page at a
+// time, for each annotator i whose last part ended with a cursor, next[i];
+// then call done().  If a part can't be read, done() is called with the
+// annotations read so far.  This stops if another record is selected
+// meanwhile.
+function read_more_annotations(next, done) {
+    var annreq = '', i, n = 0, r = db + '/' + record;
+
+    for (i = 0; i < nann; i++) {
+	if (next[i]) {
+	    annreq += '&annotator=' + encodeURIComponent(ann[i].name)
+		+ '&cursor=' + next[i];
+	    n++;
+	}
+    }
+    if (n === 0) { done(); return; }
+    get_jsonp(server + '?action=fetch&db=' + db + '&record=' + record
+	      + annreq + '&dt=0&layout=columns&limit=' + ann_page
+	      + server_flags, function(data) {
+	var a, j = 0, k;
+
+	if (r !== db + '/' + record) { return; }
+	if (!data || !data.fetch) { done(); return; }
+	for (i = 0; i < nann; i++) {
+	    if (next[i]) {
+		a = expand_columns(data.fetch.annotator[j++]);
+		ann[i].annotation = ann[i].annotation.concat(a.annotation);
+		if (a.description) {
+		    ann[i].description = ann[i].description || {};
+		    for (k in a.description) {
+			if (a.description.hasOwnProperty(k)) {
+			    ann[i].description[k] = a.description[k];
+			}
+		    }
+		}
+		next[i] = a.next;
+	    }
+	}
+	read_more_annotations(next, done);
+    }, function() {
+	if (r === db + '/' + record) { done(); }
+    });
+}
+
+// Finish reading the annotations for the current record (once all of their
+// parts have arrived; see read_annotations).
+function finish_annotations() {
+    var i, j, len, t;
+
+    adt_ticks = 0;
+    for (i = 0; i < nann; i++) {
+	len = ann[i].annotation.length;
+	if (len > 0) { t = ann[i].annotation[len-1].t; }
+	if (t > adt_ticks) { adt_ticks = t; }
+	// if an edit log exists for this annotator, load and reapply it
+	selarr = ann[i].annotation;
+	load_editlog(db, record, ann[i].name, true);
+	summarize(ann[i]);
+    }
+    if (nann > 0) {
+	ann[0].state = 2;
+	annselected = ann[0].name;
+	selarr = ann[0].annotation;
+	load_palette(ann[0].summary);
+    }
+    else {
+	load_palette([]);
+    }
+    // also load any annotators created from scratch using LightWAVE
+    if (edits_pending(db, record, "new")) {
+	for (i = 0; i < nann; i++) {
+	    if (ann[i].name === "new") { break; }
+	}
+	if (i >= nann) { new_annset(); }
+	for (i = 1; i <= 4; i++) {  // allow up to 5 new annotators
+	    if (edits_pending(db, record, "new" + i)) {
+		for (j = 0; j < nann; j++) {
+		    if (ann[j].name === "new" + i) { break; }
+		}
+		if (j >= nann) { new_annset(); }
+	    }
+	}
+    }
+    show_summary();
+    show_status(false);
+}
+
 function read_annotations(t0_string) {
-    var annreq = '', i, j, key, len, t, s, ss;
+    var annreq = '', i, j, key, s, ss, next = [];
 
     nann = 0;	// new record -- (re)fill the cache
     selann = -1;  // discard selection, if any
@@ -736,52 +987,24 @@ function read_annotations(t0_string) {
 	    annreq += '&annotator=' + encodeURIComponent(ann_set[i].name);
 	}
 	url = server + '?action=fetch&db=' + db + '&record=' + record + annreq
-	    + '&dt=0' + server_flags;
+	    + '&dt=0&layout=columns&limit=' + ann_page + server_flags;
 	show_status(true);
 	get_jsonp(url, function(data) {
 	    slist(t0_string);
-	    adt_ticks = 0;
 	    for (i = 0; i < data.fetch.annotator.length; i++, nann++) {
-		ann[i] = data.fetch.annotator[i];
+		ann[i] = expand_columns(data.fetch.annotator[i]);
 		ann[i].state = 1;
-		len = ann[i].annotation.length;
-		if (len > 0) { t = ann[i].annotation[len-1].t; }
-		if (t > adt_ticks) { adt_ticks = t; }
+		next[i] = ann[i].next;
 		for (j = 0; j < ann_set.length; j++) {
 		    if (ann[i].name === ann_set[j].name) {
 			ann[i].desc = ann_set[j].desc;
 		    }
 		}
-		// if an edit log exists for this annotator, load and reapply it
-		selarr = ann[i].annotation;
-		load_editlog(db, record, ann[i].name, true);
-		summarize(ann[i]);
-	    }
-	    if (nann > 0) {
-		ann[0].state = 2;
-		annselected = ann[0].name;
-		selarr = ann[0].annotation;
-		load_palette(ann[0].summary);
-	    }
-	    else {
-		load_palette([]);
-	    }
-	    // also load any annotators created from scratch using LightWAVE
-	    if (edits_pending(db, record, "new")) {
-		for (i = 0; i < nann; i++) {
-		    if (ann[i].name === "new") { break; }
-		}
-		if (i >= nann) { new_annset(); }
-		for (i = 1; i <= 4; i++) {  // allow up to 5 new annotators
-		    if (edits_pending(db, record, "new" + i)) {
-			for (j = 0; j < nann; j++) {
-			    if (ann[j].name === "new" + i) { break; }
-			}
-			if (j >= nann) { new_annset(); }
-		    }
-		}
 	    }
-	    show_status(false);
+	    // read the rest of each annotator (if it was too long to send
+	    // at once) before showing any of them, since finish_annotations
+	    // reapplies pending edits to the complete set
+	    read_more_annotations(next, finish_annotations);
 	});
     }
     else {
@@ -827,7 +1050,7 @@ function read_signals(t0, update) {
 	    + '&dt=' + dt_sec
 	    + server_flags;
 	show_status(true);
-	get_jsonp(url, function(data) {
+	get_fetch(url, function(data) {
 	    fetch = data.fetch;
 	    if (fetch && fetch.hasOwnProperty('signal')) {
 		s = data.fetch.signal;
@@ -0,0 +1,407 @@
+/* file: annidx.c	B. Moody	18 October 2026
+
+Indexed annotation files for the LightWAVE server
+Copyright (C) 2026 Benjamin Moody
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+The WFDB library can only find the annotations in a given time
+interval by decoding the annotation file from the beginning (each
+annotation's time, and its "chan" and "num" fields, are stored
+relative to the previous annotation's).  To make a fetch of a short
+window late in a long record cost no more than one near the start,
+the first time an annotation file is read, this module saves a copy
+of its annotations (exactly as returned by getann) in the cache
+directory, in a form that can be read starting at any annotation,
+together with an index giving the time and offset of every
+ANNIDX_BLOCK'th annotation.
+
+Each file is named after a hash of the record and annotator names,
+and contains (in the machine's native byte order, since it is only
+read by the machine that wrote it):
+
+    "LWANNX1\n"
+    record and annotator names (separated by a tab), annotation file
+      pathname
+    annotation file modification time and size, time saved (64-bit
+      integers)
+    for each annotation:
+        time (64-bit integer)
+        anntyp, subtyp, chan, num (one byte each)
+        length of aux string (16-bit integer), aux string
+    for each block:
+        time of the block's first annotation, offset of the block
+          (64-bit integers)
+    offset of the block index, number of blocks (64-bit integers)
+
+where each string is a 32-bit length followed by its characters.  As
+with saved record metadata (see meta.c), an index is used only if the
+annotation file is a local file whose size and modification time are
+unchanged, or otherwise, if the index was saved less than ANNIDX_TTL
+seconds ago.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "annidx.h"
+
+#define ANNIDX_MAGIC "LWANNX1\n"
+
+struct annidx {
+    FILE *f;
+    long long pos;              /* offset of the next annotation */
+    long long end;              /* offset of the block index */
+    long long nblocks;
+    long long *btime;           /* time of each block's first annotation */
+    long long *boffset;         /* offset of each block */
+    WFDB_Time t0;               /* annotations before t0 are skipped */
+    unsigned char aux[258];     /* length, aux string, and a null */
+};
+
+static char *annidx_dir;        /* NULL if the cache directory is disabled */
+
+/* Enable saving indexes in the given directory.  Returns 0 if
+   successful, or -1 if the directory can't be used. */
+int annidx_init(const char *dir)
+{
+    struct stat st;
+
+    if (dir == NULL || dir[0] != '/' || stat(dir, &st) != 0
+        || !S_ISDIR(st.st_mode))
+        return -1;
+    free(annidx_dir);
+    annidx_dir = strdup(dir);
+    return (annidx_dir ? 0 : -1);
+}
+
+/* Return the key "record<TAB>annotator" identifying an index. */
+static char *annidx_key(const char *record, const char *annotator)
+{
+    char *key = malloc(strlen(record) + strlen(annotator) + 2);
+
+    if (key)
+        sprintf(key, "%s\t%s", record, annotator);
+    return key;
+}
+
+/* Return the pathname of the index with the given key. */
+static char *annidx_name(const char *key)
+{
+    unsigned long long h = 14695981039346656037ULL;
+    const char *p;
+    char *name = malloc(strlen(annidx_dir) + 24);
+
+    for (p = key; *p; p++) {
+        h ^= (unsigned char) *p;
+        h *= 1099511628211ULL;
+    }
+    if (name)
+        sprintf(name, "%s/a%016llx", annidx_dir, h);
+    return name;
+}
+
+static int read_item(FILE *f, void *x, size_t n)
+{
+    return (fread(x, 1, n, f) == n ? 0 : -1);
+}
+
+/* Read a string, and return 0 if it is equal to s. */
+static int read_match(FILE *f, const char *s)
+{
+    int n;
+    size_t len = strlen(s);
+    char *buf;
+
+    if (read_item(f, &n, sizeof(n)) != 0 || n < 0 || (size_t) n != len
+        || (buf = malloc(len + 1)) == NULL)
+        return -1;
+    n = (read_item(f, buf, len) == 0 && memcmp(buf, s, len) == 0) ? 0 : -1;
+    free(buf);
+    return n;
+}
+
+static void write_string(FILE *f, const char *s)
+{
+    int n = strlen(s);
+
+    fwrite(&n, sizeof(n), 1, f);
+    fwrite(s, 1, n, f);
+}
+
+/* Get the modification time and size of an annotation file, or zero
+   for a file that isn't local.  Returns 0 if successful, -1 if the file
+   doesn't exist. */
+static int file_stamp(const char *path, long long *mtime, long long *size)
+{
+    struct stat st;
+
+    if (strstr(path, "://")) {
+        *mtime = *size = 0;
+        return 0;
+    }
+    if (stat(path, &st) != 0)
+        return -1;
+    *mtime = st.st_mtime;
+    *size = st.st_size;
+    return 0;
+}
+
+/* Open the index for an annotator of a record, whose annotation file is
+   path (as found by wfdbfile).  Returns NULL if there is no index, or it
+   is out of date. */
+ANNIDX *annidx_open(const char *record, const char *annotator,
+                    const char *path)
+{
+    ANNIDX *x;
+    char *key, *name;
+    char magic[sizeof(ANNIDX_MAGIC) - 1];
+    long long mtime, size, saved, fmtime, fsize, trailer[2];
+    time_t now = time(NULL);
+    FILE *f;
+    int ok;
+
+    if (annidx_dir == NULL || path == NULL
+        || (key = annidx_key(record, annotator)) == NULL)
+        return NULL;
+    if ((name = annidx_name(key)) == NULL) {
+        free(key);
+        return NULL;
+    }
+    f = fopen(name, "rb");
+    free(name);
+    if (f == NULL) {
+        free(key);
+        return NULL;
+    }
+
+    ok = (read_item(f, magic, sizeof(magic)) == 0
+          && memcmp(magic, ANNIDX_MAGIC, sizeof(magic)) == 0
+          && read_match(f, key) == 0 && read_match(f, path) == 0
+          && read_item(f, &mtime, sizeof(mtime)) == 0
+          && read_item(f, &size, sizeof(size)) == 0
+          && read_item(f, &saved, sizeof(saved)) == 0
+          && file_stamp(path, &fmtime, &fsize) == 0);
+    free(key);
+    if (ok && strstr(path, "://"))
+        ok = (saved <= now && now - saved < ANNIDX_TTL);
+    else if (ok)
+        ok = (mtime == fmtime && size == fsize);
+    if (!ok || (x = calloc(1, sizeof(ANNIDX))) == NULL) {
+        fclose(f);
+        return NULL;
+    }
+    x->f = f;
+    x->pos = ftell(f);
+
+    if (fseek(f, -(long) sizeof(trailer), SEEK_END) != 0
+        || read_item(f, trailer, sizeof(trailer)) != 0
+        || trailer[0] < x->pos || trailer[1] < 1
+        || (unsigned long long) trailer[1] > (size_t) -1 / sizeof(long long)
+        || (x->btime = malloc(trailer[1] * sizeof(long long))) == NULL
+        || (x->boffset = malloc(trailer[1] * sizeof(long long))) == NULL
+        || fseek(f, trailer[0], SEEK_SET) != 0) {
+        annidx_close(x);
+        return NULL;
+    }
+    x->end = trailer[0];
+    for (x->nblocks = 0; x->nblocks < trailer[1]; x->nblocks++)
+        if (read_item(f, &x->btime[x->nblocks], sizeof(long long)) != 0
+            || read_item(f, &x->boffset[x->nblocks], sizeof(long long)) != 0
+            || x->boffset[x->nblocks] < x->pos
+            || x->boffset[x->nblocks] > x->end) {
+            annidx_close(x);
+            return NULL;
+        }
+    if (fseek(f, x->pos, SEEK_SET) != 0) {
+        annidx_close(x);
+        return NULL;
+    }
+    return x;
+}
+
+/* Position the index so that the next annotation read is the first one
+   at or after time t.  Returns 0 if successful, or -1 on error. */
+int annidx_seek(ANNIDX *x, WFDB_Time t)
+{
+    long long lo = 0, hi = x->nblocks - 1, mid;
+
+    /* Find the last block that begins before t (any annotations at time t
+       in the block before that are still found). */
+    while (lo < hi) {
+        mid = lo + (hi - lo + 1) / 2;
+        if (x->btime[mid] < t)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    if (fseek(x->f, x->boffset[lo], SEEK_SET) != 0)
+        return -1;
+    x->pos = x->boffset[lo];
+    x->t0 = t;
+    return 0;
+}
+
+/* Read the next annotation, as getann() would.  annot->aux points to
+   storage belonging to x, which is overwritten by the next call.
+   Returns 0 if successful, or -1 at the end of the file or on error. */
+int annidx_get(ANNIDX *x, WFDB_Annotation *annot)
+{
+    long long t;
+    unsigned char b[4];
+    unsigned short auxlen;
+
+    do {
+        if (x->pos >= x->end
+            || read_item(x->f, &t, sizeof(t)) != 0
+            || read_item(x->f, b, sizeof(b)) != 0
+            || read_item(x->f, &auxlen, sizeof(auxlen)) != 0
+            || auxlen > 255
+            || read_item(x->f, x->aux + 1, auxlen) != 0)
+            return -1;
+        x->pos += sizeof(t) + sizeof(b) + sizeof(auxlen) + auxlen;
+    } while (t < x->t0);
+
+    annot->time = t;
+    annot->anntyp = b[0];
+    annot->subtyp = (signed char) b[1];
+    annot->chan = b[2];
+    annot->num = (signed char) b[3];
+    x->aux[0] = auxlen;
+    x->aux[auxlen + 1] = '\0';
+    annot->aux = (auxlen > 0) ? x->aux : NULL;
+    return 0;
+}
+
+void annidx_close(ANNIDX *x)
+{
+    if (x == NULL)
+        return;
+    if (x->f)
+        fclose(x->f);
+    free(x->btime);
+    free(x->boffset);
+    free(x);
+}
+
+/* Read all remaining annotations from input annotator an (which must
+   have just been opened by annopen), and save them as the index for the
+   named annotator of a record.  Returns 0 if successful, or -1 if the
+   index couldn't be saved. */
+int annidx_build(const char *record, const char *annotator, const char *path,
+                 WFDB_Annotator an)
+{
+    WFDB_Annotation annot;
+    char *key, *name = NULL, *tmp = NULL;
+    long long mtime, size, pos, n = 0, nblocks = 0, *bt = NULL, *bo = NULL,
+        t, saved = time(NULL);
+    unsigned char b[4];
+    unsigned short auxlen;
+    void *p;
+    FILE *f = NULL;
+    int fd, err = 0;
+
+    if (annidx_dir == NULL || path == NULL
+        || file_stamp(path, &mtime, &size) != 0
+        || (key = annidx_key(record, annotator)) == NULL)
+        return -1;
+    if ((name = annidx_name(key)) == NULL
+        || (tmp = malloc(strlen(name) + 8)) == NULL) {
+        free(key);
+        free(name);
+        return -1;
+    }
+    sprintf(tmp, "%s.XXXXXX", name);
+    if ((fd = mkstemp(tmp)) < 0 || (f = fdopen(fd, "wb")) == NULL) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp);
+        }
+        free(key);
+        free(name);
+        free(tmp);
+        return -1;
+    }
+
+    fputs(ANNIDX_MAGIC, f);
+    write_string(f, key);
+    write_string(f, path);
+    fwrite(&mtime, sizeof(mtime), 1, f);
+    fwrite(&size, sizeof(size), 1, f);
+    fwrite(&saved, sizeof(saved), 1, f);
+    pos = ftell(f);
+    free(key);
+
+    while (!err && getann(an, &annot) == 0) {
+        if (n % ANNIDX_BLOCK == 0) {
+            if ((p = realloc(bt, (nblocks + 1) * sizeof(long long))) == NULL)
+                err = 1;
+            else
+                bt = p;
+            if ((p = realloc(bo, (nblocks + 1) * sizeof(long long))) == NULL)
+                err = 1;
+            else
+                bo = p;
+            if (err)
+                break;
+            bt[nblocks] = annot.time;
+            bo[nblocks++] = pos;
+        }
+        t = annot.time;
+        b[0] = annot.anntyp;
+        b[1] = annot.subtyp;
+        b[2] = annot.chan;
+        b[3] = annot.num;
+        auxlen = annot.aux ? annot.aux[0] : 0;
+        fwrite(&t, sizeof(t), 1, f);
+        fwrite(b, 1, sizeof(b), f);
+        fwrite(&auxlen, sizeof(auxlen), 1, f);
+        if (auxlen)
+            fwrite(annot.aux + 1, 1, auxlen, f);
+        pos += sizeof(t) + sizeof(b) + sizeof(auxlen) + auxlen;
+        n++;
+    }
+
+    /* An empty file still has one (empty) block. */
+    if (!err && nblocks == 0) {
+        if ((bt = malloc(sizeof(long long))) == NULL
+            || (bo = malloc(sizeof(long long))) == NULL)
+            err = 1;
+        else {
+            bt[0] = 0;
+            bo[nblocks++] = pos;
+        }
+    }
+    if (!err) {
+        for (n = 0; n < nblocks; n++) {
+            fwrite(&bt[n], sizeof(long long), 1, f);
+            fwrite(&bo[n], sizeof(long long), 1, f);
+        }
+        fwrite(&pos, sizeof(pos), 1, f);
+        fwrite(&nblocks, sizeof(nblocks), 1, f);
+    }
+    free(bt);
+    free(bo);
+    fchmod(fileno(f), 0644);
+    if (fclose(f) != 0 || err || rename(tmp, name) != 0) {
+        unlink(tmp);
+        err = 1;
+    }
+    free(tmp);
+    free(name);
+    return (err ? -1 : 0);
+}
@@ -0,0 +1,45 @@
+/* file: annidx.h	B. Moody	18 October 2026
+
+Indexed annotation files for the LightWAVE server
+Copyright (C) 2026 Benjamin Moody
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIGHTWAVE_ANNIDX_H
+#define LIGHTWAVE_ANNIDX_H
+
+#include <wfdb/wfdb.h>
+
+/* Number of annotations in each block of an index; a windowed read
+   decodes at most this many annotations before the start of the window. */
+#define ANNIDX_BLOCK	256
+
+/* An index of an annotation file that isn't a local file (so that its
+   modification time can't be checked) is used for at most this many
+   seconds. */
+#define ANNIDX_TTL	3600
+
+typedef struct annidx ANNIDX;
+
+int annidx_init(const char *dir);
+ANNIDX *annidx_open(const char *record, const char *annotator,
+		    const char *path);
+int annidx_build(const char *record, const char *annotator, const char *path,
+		 WFDB_Annotator an);
+int annidx_seek(ANNIDX *x, WFDB_Time t);
+int annidx_get(ANNIDX *x, WFDB_Annotation *annot);
+void annidx_close(ANNIDX *x);
+
+#endif
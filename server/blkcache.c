@@ -0,0 +1,635 @@
+/* file: blkcache.c	B. Moody	18 October 2026
+
+Block cache for remote files read by the LightWAVE server
+Copyright (C) 2026 Benjamin Moody
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+When a record is in a remote (HTTP) repository, the WFDB library
+fetches its files from the remote server each time they are opened,
+and nothing is kept between one request (or process) and the next.
+Record metadata and annotations are already saved locally (see meta.c
+and annidx.c), leaving signal files, which are much larger, and which
+are usually read a small part at a time.  This module keeps the parts
+of remote files that have been read in a cache directory, shared by
+all of the server's processes, so that sigread.c can decode them as if
+they were local.
+
+Files are fetched and cached in blocks of BLKCACHE_BLOCK bytes, using
+HTTP range requests.  When a block isn't in the cache, it is fetched
+together with up to BLKCACHE_FETCH - 1 following blocks (stopping at
+one that is already cached), since a reader that needs one part of a
+signal file usually needs the next part soon after.  A server that
+ignores the range, and sends the whole file, is also handled.
+
+Each remote file has an information file, named after a hash of its
+URL, giving the URL, the file's size, the time when the size was last
+checked, and its validator (the ETag or Last-Modified header given by
+the server):
+
+    LWBLKC1
+    <url>
+    <size> <time checked>
+    <validator>
+
+A file's size and validator are rechecked, with a HEAD request, when
+it is opened if they were last checked more than BLKCACHE_TTL seconds
+ago.  (If the server can't be reached, the saved information is used
+anyway.)  Each block file is named after a hash of the URL, size, and
+validator, together with the block number, so a file that has changed
+is simply cached again under different names; as with saved record
+metadata, a file that changes less than BLKCACHE_TTL seconds after it
+was checked may not be noticed until the next check.
+
+The total size of the block files is kept under a limit by removing
+the least recently used blocks (the modification time of a block file
+is updated each time it is read).  An approximate total is kept in the
+file "usage", and updated by each process after it adds a block, while
+holding a lock on that file; when the total exceeds the limit, the
+process holding the lock counts the block files, and removes the
+oldest until the total is 90% of the limit.  All files are written to
+a temporary name and renamed, so concurrent readers never see a
+partial file.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <curl/curl.h>
+#include "blkcache.h"
+
+#define BLKCACHE_MAGIC "LWBLKC1\n"
+
+struct blkfile {
+    char *url;
+    long long size;             /* size of the file in bytes */
+    unsigned long long gen;     /* hash identifying this version of it */
+};
+
+/* The state of a transfer from the remote server. */
+struct transfer {
+    BLKFILE *f;
+    int status;                 /* HTTP status of the last response */
+    long long length;           /* its Content-Length, or -1 */
+    long long start;            /* offset of its body in the file */
+    char validator[256];        /* "E" + ETag, "L" + Last-Modified, or "" */
+    long long pos;              /* offset of the next byte received */
+    long long end;              /* offset at which to stop */
+    unsigned char *blk;         /* block being received */
+    unsigned char *dst;         /* caller's buffer */
+    long long dst_off;          /* offset of the bytes wanted in dst */
+    size_t dst_len;
+};
+
+static char *blk_dir;           /* NULL if the cache is disabled */
+static long long blk_limit;     /* maximum total size of the blocks */
+static CURL *curl;
+
+/* Enable the cache, using the given directory, and keeping the cached
+   blocks to no more than limit bytes.  Returns 0 if successful, or -1
+   if the directory can't be used. */
+int blkcache_init(const char *dir, long long limit)
+{
+    struct stat st;
+
+    if (dir == NULL || dir[0] != '/' || stat(dir, &st) != 0
+        || !S_ISDIR(st.st_mode) || limit < BLKCACHE_BLOCK)
+        return -1;
+    free(blk_dir);
+    blk_dir = strdup(dir);
+    blk_limit = limit;
+    return (blk_dir ? 0 : -1);
+}
+
+/* Return the FNV-1a hash of a string, continuing from hash h. */
+static unsigned long long hash(unsigned long long h, const char *s)
+{
+    for (; *s; s++) {
+        h ^= (unsigned char) *s;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+#define HASH_INIT 14695981039346656037ULL
+
+static char *info_name(const char *url)
+{
+    char *name = malloc(strlen(blk_dir) + 24);
+
+    if (name)
+        sprintf(name, "%s/i%016llx", blk_dir, hash(HASH_INIT, url));
+    return name;
+}
+
+static void block_name(char *name, const BLKFILE *f, long long b)
+{
+    sprintf(name, "%s/b%016llx.%llx", blk_dir, f->gen, b);
+}
+
+/* Return the length of block b of a file. */
+static long long block_len(const BLKFILE *f, long long b)
+{
+    long long n = f->size - b * BLKCACHE_BLOCK;
+
+    return (n < BLKCACHE_BLOCK ? n : BLKCACHE_BLOCK);
+}
+
+/* Write a file under a temporary name, then rename it to name.  Returns
+   0 if successful, or -1 otherwise. */
+static int write_file(const char *name, const void *data, size_t len)
+{
+    char *tmp;
+    int fd, ok = 0;
+
+    if ((tmp = malloc(strlen(name) + 8)) == NULL)
+        return -1;
+    sprintf(tmp, "%s.XXXXXX", name);
+    if ((fd = mkstemp(tmp)) >= 0) {
+        ok = (write(fd, data, len) == (ssize_t) len
+              && fchmod(fd, 0644) == 0);
+        if (close(fd) != 0 || !ok || rename(tmp, name) != 0) {
+            unlink(tmp);
+            ok = 0;
+        }
+    }
+    free(tmp);
+    return (ok ? 0 : -1);
+}
+
+/* The information needed to order block files by last use. */
+struct entry {
+    time_t mtime;
+    long long size;
+    char name[40];
+};
+
+static int compare_entries(const void *a, const void *b)
+{
+    const struct entry *x = a, *y = b;
+
+    return (x->mtime > y->mtime) - (x->mtime < y->mtime);
+}
+
+/* Count the block files, and remove the least recently used until
+   their total size is 90% of the limit.  Temporary files more than an
+   hour old (left by a process that was killed) are also removed.
+   Returns the total size of the remaining blocks. */
+static long long sweep(void)
+{
+    DIR *d;
+    struct dirent *e;
+    struct entry *v = NULL, *p;
+    struct stat st;
+    size_t n = 0, max = 0, i;
+    long long total = 0;
+    time_t now = time(NULL);
+    char *path, *q;
+
+    if ((d = opendir(blk_dir)) == NULL)
+        return 0;
+    if ((path = malloc(strlen(blk_dir) + 48)) == NULL) {
+        closedir(d);
+        return 0;
+    }
+    while ((e = readdir(d)) != NULL) {
+        if (e->d_name[0] != 'b' || strlen(e->d_name) >= sizeof(v->name)
+            || (q = strchr(e->d_name, '.')) == NULL)
+            continue;
+        sprintf(path, "%s/%s", blk_dir, e->d_name);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+        if (strchr(q + 1, '.')) {
+            if (now - st.st_mtime > 3600)
+                unlink(path);
+            continue;
+        }
+        if (n == max) {
+            max = max ? 2 * max : 1024;
+            if ((p = realloc(v, max * sizeof(*v))) == NULL)
+                break;
+            v = p;
+        }
+        v[n].mtime = st.st_mtime;
+        v[n].size = st.st_size;
+        strcpy(v[n].name, e->d_name);
+        total += st.st_size;
+        n++;
+    }
+    closedir(d);
+
+    qsort(v, n, sizeof(*v), compare_entries);
+    for (i = 0; i < n && total > blk_limit - blk_limit / 10; i++) {
+        sprintf(path, "%s/%s", blk_dir, v[i].name);
+        if (unlink(path) == 0)
+            total -= v[i].size;
+    }
+    free(v);
+    free(path);
+    return total;
+}
+
+/* Add len bytes to the total size of the blocks, and remove old blocks
+   if the total is over the limit. */
+static void note_usage(long long len)
+{
+    char *name, buf[32];
+    long long total;
+    ssize_t k;
+    int fd;
+
+    if ((name = malloc(strlen(blk_dir) + 8)) == NULL)
+        return;
+    sprintf(name, "%s/usage", blk_dir);
+    fd = open(name, O_RDWR | O_CREAT, 0644);
+    free(name);
+    if (fd < 0)
+        return;
+    if (flock(fd, LOCK_EX) == 0) {
+        k = pread(fd, buf, sizeof(buf) - 1, 0);
+        buf[k > 0 ? k : 0] = '\0';
+        total = atoll(buf) + len;
+        if (total > blk_limit)
+            total = sweep();
+        k = sprintf(buf, "%lld\n", total);
+        if (pwrite(fd, buf, k, 0) == k)
+            ftruncate(fd, k);
+    }
+    close(fd);
+}
+
+/* Save block b of a file. */
+static void store_block(const BLKFILE *f, long long b, const void *data)
+{
+    char *name;
+
+    if ((name = malloc(strlen(blk_dir) + 48)) == NULL)
+        return;
+    block_name(name, f, b);
+    if (write_file(name, data, block_len(f, b)) == 0)
+        note_usage(block_len(f, b));
+    free(name);
+}
+
+/* Copy the part of block b of a file that lies within len bytes
+   beginning at off into buf, if the block is in the cache.  Returns 0
+   if successful, or -1 if the block isn't in the cache. */
+static int read_block(const BLKFILE *f, long long b, long long off,
+                      unsigned char *buf, size_t len)
+{
+    char *name;
+    struct stat st;
+    long long start = b * BLKCACHE_BLOCK, end = start + block_len(f, b);
+    int fd, ok;
+
+    if ((name = malloc(strlen(blk_dir) + 48)) == NULL)
+        return -1;
+    block_name(name, f, b);
+    fd = open(name, O_RDONLY);
+    free(name);
+    if (fd < 0)
+        return -1;
+    if (start < off)
+        start = off;
+    if (end > off + (long long) len)
+        end = off + len;
+    ok = (fstat(fd, &st) == 0 && st.st_size == block_len(f, b)
+          && pread(fd, buf + (start - off), end - start,
+                   start - b * BLKCACHE_BLOCK) == end - start);
+    if (ok)
+        futimens(fd, NULL);     /* mark the block as recently used */
+    close(fd);
+    return (ok ? 0 : -1);
+}
+
+static size_t header_cb(char *p, size_t size, size_t n, void *data)
+{
+    struct transfer *t = data;
+    size_t len = size * n, k;
+    char line[512], *v;
+    long long a, b, c;
+
+    k = (len < sizeof(line) ? len : sizeof(line) - 1);
+    memcpy(line, p, k);
+    line[k] = '\0';
+    line[strcspn(line, "\r\n")] = '\0';
+    v = strchr(line, ':');
+
+    if (strncmp(line, "HTTP/", 5) == 0) {
+        /* A new response (after a redirection, for example). */
+        t->status = (v = strchr(line, ' ')) ? atoi(v + 1) : 0;
+        t->length = -1;
+        t->start = 0;
+        t->validator[0] = '\0';
+    }
+    else if (line[0] == '\0')   /* end of the headers */
+        t->pos = t->start;
+    else if (v) {
+        *v++ = '\0';
+        v += strspn(v, " \t");
+        if (strcasecmp(line, "Content-Length") == 0)
+            t->length = atoll(v);
+        else if (strcasecmp(line, "Content-Range") == 0) {
+            if (sscanf(v, "bytes %lld-%lld/%lld", &a, &b, &c) == 3)
+                t->start = a;
+        }
+        else if (strcasecmp(line, "ETag") == 0)
+            snprintf(t->validator, sizeof(t->validator), "E%s", v);
+        else if (strcasecmp(line, "Last-Modified") == 0
+                 && t->validator[0] != 'E')
+            snprintf(t->validator, sizeof(t->validator), "L%s", v);
+    }
+    return len;
+}
+
+static size_t write_cb(char *p, size_t size, size_t n, void *data)
+{
+    struct transfer *t = data;
+    const BLKFILE *f = t->f;
+    size_t len = size * n, k;
+    long long a, b, o;
+
+    if ((t->status != 200 && t->status != 206)
+        || (t->pos == t->start && t->pos % BLKCACHE_BLOCK != 0))
+        return 0;
+    while (len > 0) {
+        if (t->pos >= t->end)
+            return 0;           /* got everything wanted */
+        o = t->pos % BLKCACHE_BLOCK;
+        k = BLKCACHE_BLOCK - o;
+        if (k > len)
+            k = len;
+        memcpy(t->blk + o, p, k);
+
+        /* Copy the bytes that the caller wants. */
+        a = (t->pos > t->dst_off ? t->pos : t->dst_off);
+        b = t->pos + k;
+        if (b > t->dst_off + (long long) t->dst_len)
+            b = t->dst_off + t->dst_len;
+        if (a < b)
+            memcpy(t->dst + (a - t->dst_off), p + (a - t->pos), b - a);
+
+        t->pos += k;
+        p += k;
+        len -= k;
+        if (t->pos % BLKCACHE_BLOCK == 0 || t->pos == f->size) {
+            if (t->pos > f->size)
+                return 0;       /* the file has changed */
+            store_block(f, (t->pos - 1) / BLKCACHE_BLOCK, t->blk);
+        }
+    }
+    return size * n;
+}
+
+/* Prepare the curl handle for a new transfer. */
+static CURL *start_transfer(struct transfer *t, const char *url)
+{
+    if (curl == NULL && (curl = curl_easy_init()) == NULL)
+        return NULL;
+    curl_easy_reset(curl);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 30L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, (long) BLKCACHE_LOW_SPEED);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long) BLKCACHE_STALL);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "LightWAVE");
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_cb);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, t);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, t);
+    t->status = 0;
+    t->length = -1;
+    return curl;
+}
+
+/* Fetch the bytes of a file from off0 to off1 (a whole number of blocks,
+   or to the end of the file), saving them in the cache, and copying
+   len of them, beginning at off, into buf.  Returns 0 if successful, or
+   -1 otherwise. */
+static int fetch(BLKFILE *f, long long off0, long long off1, long long off,
+                 unsigned char *buf, size_t len)
+{
+    struct transfer t;
+    char range[64];
+    int ok;
+
+    memset(&t, 0, sizeof(t));
+    if ((t.blk = malloc(BLKCACHE_BLOCK)) == NULL
+        || start_transfer(&t, f->url) == NULL) {
+        free(t.blk);
+        return -1;
+    }
+    t.f = f;
+    t.end = off1;
+    t.dst = buf;
+    t.dst_off = off;
+    t.dst_len = len;
+    sprintf(range, "%lld-%lld", off0, off1 - 1);
+    curl_easy_setopt(curl, CURLOPT_RANGE, range);
+    curl_easy_perform(curl);
+    free(t.blk);
+
+    /* The transfer is stopped early (which curl reports as an error) if
+       the server sends more than was asked for, so check only that the
+       wanted bytes were received. */
+    ok = ((t.status == 206 && t.start == off0) || t.status == 200)
+        && t.pos >= off + (long long) len;
+    return (ok ? 0 : -1);
+}
+
+/* Check the size and validator of a remote file with the server.
+   Returns 0 if successful, -1 if the file doesn't exist, or -2 if the
+   server can't be reached. */
+static int check_remote(BLKFILE *f, char *validator, size_t size)
+{
+    struct transfer t;
+
+    memset(&t, 0, sizeof(t));
+    if (start_transfer(&t, f->url) == NULL)
+        return -2;
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    if (curl_easy_perform(curl) != CURLE_OK)
+        return (t.status ? -1 : -2);
+    if (t.status != 200 || t.length < 0)
+        return -1;
+    f->size = t.length;
+    snprintf(validator, size, "%s", t.validator);
+    return 0;
+}
+
+/* Open a remote file for reading through the cache.  Returns NULL if
+   the cache is disabled, the URL isn't an HTTP URL, or the file can't
+   be found. */
+BLKFILE *blkcache_open(const char *url)
+{
+    BLKFILE *f;
+    FILE *fp;
+    char *name, *buf = NULL, line[1024], validator[256] = "";
+    long long checked = -1;
+    time_t now = time(NULL);
+    int status = 0;
+
+    if (blk_dir == NULL || url == NULL || strchr(url, '\n')
+        || (strncmp(url, "http://", 7) != 0
+            && strncmp(url, "https://", 8) != 0)
+        || (f = calloc(1, sizeof(BLKFILE))) == NULL)
+        return NULL;
+    if ((f->url = strdup(url)) == NULL || (name = info_name(url)) == NULL) {
+        blkcache_close(f);
+        return NULL;
+    }
+
+    /* Read the saved information, if any. */
+    if ((fp = fopen(name, "r")) != NULL) {
+        if (!fgets(line, sizeof(line), fp)
+            || strcmp(line, BLKCACHE_MAGIC) != 0
+            || !fgets(line, sizeof(line), fp)
+            || strcspn(line, "\n") != strlen(url)
+            || strncmp(line, url, strlen(url)) != 0
+            || !fgets(line, sizeof(line), fp)
+            || sscanf(line, "%lld %lld", &f->size, &checked) != 2
+            || !fgets(validator, sizeof(validator), fp))
+            checked = -1;
+        validator[strcspn(validator, "\n")] = '\0';
+        fclose(fp);
+    }
+
+    /* Check it with the server if it is missing or out of date. */
+    if (checked < 0 || checked > now || now - checked >= BLKCACHE_TTL) {
+        status = check_remote(f, validator, sizeof(validator));
+        if (status == -1 || (status == -2 && checked < 0)) {
+            if (status == -1)
+                unlink(name);
+            free(name);
+            blkcache_close(f);
+            return NULL;
+        }
+        if (status == 0 && (buf = malloc(strlen(url) + strlen(validator)
+                                         + 64))) {
+            sprintf(buf, "%s%s\n%lld %lld\n%s\n", BLKCACHE_MAGIC, url,
+                    f->size, (long long) now, validator);
+            write_file(name, buf, strlen(buf));
+            free(buf);
+        }
+    }
+    free(name);
+
+    sprintf(line, "\n%lld ", f->size);
+    f->gen = hash(hash(hash(HASH_INIT, url), line), validator);
+    return f;
+}
+
+/* Return the size of a remote file in bytes. */
+long long blkcache_size(const BLKFILE *f)
+{
+    return f->size;
+}
+
+/* Read len bytes of a remote file, beginning at off, into buf, fetching
+   any that aren't in the cache.  Returns 0 if successful, or -1 if the
+   bytes can't be read. */
+int blkcache_read(BLKFILE *f, long long off, void *buf, size_t len)
+{
+    long long b, e, b1, nblocks;
+    char *name;
+
+    if (off < 0 || off + (long long) len > f->size)
+        return -1;
+    if (len == 0)
+        return 0;
+    b1 = (off + len + BLKCACHE_BLOCK - 1) / BLKCACHE_BLOCK;
+    for (b = off / BLKCACHE_BLOCK; b < b1; b++) {
+        if (read_block(f, b, off, buf, len) == 0)
+            continue;
+
+        /* Fetch the rest of the blocks wanted, and the following ones up
+           to BLKCACHE_FETCH blocks in all, unless they are cached. */
+        nblocks = (f->size + BLKCACHE_BLOCK - 1) / BLKCACHE_BLOCK;
+        e = b + BLKCACHE_FETCH;
+        if (e < b1)
+            e = b1;
+        if (e > nblocks)
+            e = nblocks;
+        if ((name = malloc(strlen(blk_dir) + 48)) == NULL)
+            return -1;
+        for (b1 = (b1 > b + 1 ? b1 : b + 1); b1 < e; b1++) {
+            block_name(name, f, b1);
+            if (access(name, F_OK) == 0)
+                break;
+        }
+        free(name);
+        e = b1 * BLKCACHE_BLOCK;
+        return fetch(f, b * BLKCACHE_BLOCK, (e < f->size ? e : f->size),
+                     off, buf, len);
+    }
+    return 0;
+}
+
+/* Fetch any of len bytes of a remote file, beginning at off, that aren't
+   already in the cache (for reading them later). */
+void blkcache_prefetch(BLKFILE *f, long long off, size_t len)
+{
+    long long b, e, b1;
+    char *name;
+
+    if (off < 0 || off >= f->size || len == 0
+        || (name = malloc(strlen(blk_dir) + 48)) == NULL)
+        return;
+    if (off + (long long) len > f->size)
+        len = f->size - off;
+    b1 = (off + len + BLKCACHE_BLOCK - 1) / BLKCACHE_BLOCK;
+    for (b = off / BLKCACHE_BLOCK; b < b1; b = e) {
+        block_name(name, f, b);
+        if (access(name, F_OK) == 0) {
+            e = b + 1;
+            continue;
+        }
+        for (e = b + 1; e < b1; e++) {
+            block_name(name, f, e);
+            if (access(name, F_OK) == 0)
+                break;
+        }
+        e *= BLKCACHE_BLOCK;
+        if (fetch(f, b * BLKCACHE_BLOCK, (e < f->size ? e : f->size),
+                  b * BLKCACHE_BLOCK, NULL, 0) != 0)
+            break;
+        e /= BLKCACHE_BLOCK;
+    }
+    free(name);
+}
+
+void blkcache_close(BLKFILE *f)
+{
+    if (f == NULL)
+        return;
+    free(f->url);
+    free(f);
+}
+
+/* Called in a child process after fork(), so that the child makes its
+   own connections rather than sharing those the parent kept open (the
+   handle is abandoned rather than cleaned up, since cleaning it up
+   would close the parent's connections too). */
+void blkcache_forked(void)
+{
+    curl = NULL;
+}
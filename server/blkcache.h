@@ -0,0 +1,55 @@
+/* file: blkcache.h	B. Moody	18 October 2026
+
+Block cache for remote files read by the LightWAVE server
+Copyright (C) 2026 Benjamin Moody
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIGHTWAVE_BLKCACHE_H
+#define LIGHTWAVE_BLKCACHE_H
+
+#include <stddef.h>
+
+/* Size (in bytes) of the blocks in which remote files are fetched and
+   cached. */
+#define BLKCACHE_BLOCK	65536
+
+/* Minimum number of blocks fetched at once (fewer are fetched only at
+   the end of a file, or if the following blocks are already cached). */
+#define BLKCACHE_FETCH	16
+
+/* A remote file's size and validator are rechecked with the server if
+   they were last checked more than this many seconds ago. */
+#define BLKCACHE_TTL	3600
+
+/* Default limit on the total size of the cached blocks, in megabytes. */
+#define BLKCACHE_SIZE	1024
+
+/* A transfer is abandoned if fewer than BLKCACHE_LOW_SPEED bytes per
+   second are received from the server for BLKCACHE_STALL seconds. */
+#define BLKCACHE_LOW_SPEED	1024
+#define BLKCACHE_STALL	30
+
+typedef struct blkfile BLKFILE;
+
+int blkcache_init(const char *dir, long long limit);
+BLKFILE *blkcache_open(const char *url);
+long long blkcache_size(const BLKFILE *f);
+int blkcache_read(BLKFILE *f, long long off, void *buf, size_t len);
+void blkcache_prefetch(BLKFILE *f, long long off, size_t len);
+void blkcache_close(BLKFILE *f);
+void blkcache_forked(void);
+
+#endif
@@ -0,0 +1,304 @@
+/* file: cache.c	B. Moody	18 October 2026
+
+On-disk response cache for the LightWAVE server
+Copyright (C) 2026 Benjamin Moody
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Each cache entry is a file in the cache directory, named after a hash
+of the entry's key (a string describing the request, built by the
+caller).  The file contains the key itself (to detect hash
+collisions), the list of files that the response was made from, with
+their sizes and modification times, and the response body:
+
+    LWCACHE1
+    <key>
+    <number of files>
+    <mtime> <size> <pathname>
+    ...
+    <length of body>
+    <body>
+
+An entry is used only if all of the listed files still exist and are
+unchanged (a file listed with a size of -1 must still not exist).
+Entries are written to a temporary file and renamed, so that
+concurrent readers never see a partial entry.  Nothing is ever
+deleted from the cache; old entries can be removed at any time (for
+example, by a cron job).
+
+The same list of files is used to make validators (ETag and
+Last-Modified) for the response, whether or not the cache directory
+is enabled.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "cache.h"
+
+#define CACHE_MAGIC "LWCACHE1\n"
+
+#define XREALLOC(arr, n) do {                              \
+        void *p_ = (arr);                                  \
+        size_t n_ = (n);                                   \
+        size_t m_ = sizeof((arr)[0]);                      \
+        assert(n_ <= ((size_t) -1 / m_));                  \
+        p_ = realloc(p_, n_ * m_);                         \
+        assert(p_ != NULL);                                \
+        (arr) = p_;                                        \
+    } while (0)
+
+struct dep {
+    char *path;
+    long long mtime;
+    long long size;
+};
+
+static char *cache_dir;         /* NULL if the cache directory is disabled */
+static struct dep *deps;        /* files used by the current response */
+static size_t n_deps;
+static int uncacheable;         /* true if a dependency can't be checked */
+
+/* Enable the cache, using the given directory.  Returns 0 if
+   successful, or -1 if the directory can't be used. */
+int cache_init(const char *dir)
+{
+    struct stat st;
+
+    if (dir == NULL || dir[0] != '/' || stat(dir, &st) != 0
+        || !S_ISDIR(st.st_mode))
+        return -1;
+    free(cache_dir);
+    cache_dir = strdup(dir);
+    return (cache_dir ? 0 : -1);
+}
+
+/* Forget the files used by the previous response. */
+void cache_reset(void)
+{
+    size_t i;
+
+    for (i = 0; i < n_deps; i++)
+        free(deps[i].path);
+    n_deps = 0;
+    uncacheable = 0;
+}
+
+static void add_dep(const char *path, long long mtime, long long size)
+{
+    XREALLOC(deps, n_deps + 1);
+    deps[n_deps].path = strdup(path);
+    deps[n_deps].mtime = mtime;
+    deps[n_deps].size = size;
+    if (deps[n_deps].path == NULL)
+        uncacheable = 1;
+    else
+        n_deps++;
+}
+
+/* Note that the current response depends on the contents of the named
+   local file.  If path is NULL (for example, because the file couldn't
+   be found, or isn't local), the response can't be cached. */
+void cache_depend(const char *path)
+{
+    struct stat st;
+
+    if (path == NULL || strchr(path, '\n') || stat(path, &st) != 0
+        || !S_ISREG(st.st_mode))
+        uncacheable = 1;
+    else
+        add_dep(path, st.st_mtime, st.st_size);
+}
+
+/* Note that the current response depends on the contents of the named
+   local file if it exists, or on its absence otherwise. */
+void cache_depend_optional(const char *path)
+{
+    struct stat st;
+
+    if (path == NULL || strchr(path, '\n'))
+        uncacheable = 1;
+    else if (stat(path, &st) != 0)
+        add_dep(path, 0, -1);
+    else if (!S_ISREG(st.st_mode))
+        uncacheable = 1;
+    else
+        add_dep(path, st.st_mtime, st.st_size);
+}
+
+/* Return the FNV-1a hash of a string, continuing from hash h. */
+static unsigned long long hash(unsigned long long h, const char *s)
+{
+    for (; *s; s++) {
+        h ^= (unsigned char) *s;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+#define HASH_INIT 14695981039346656037ULL
+
+/* Return the pathname of the cache entry for key. */
+static char *entry_name(const char *key)
+{
+    char *name = malloc(strlen(cache_dir) + 24);
+
+    if (name)
+        sprintf(name, "%s/%016llx", cache_dir, hash(HASH_INIT, key));
+    return name;
+}
+
+/* Make validators for the current response, which is identified by key
+   and depends on the files given to cache_depend().  etag is set to a
+   (weak) entity tag, and *last_modified to the time that the newest of
+   the files was modified, or 0 if there are none.  Returns 0 if
+   successful, or -1 if the response has no validators because one of
+   its files can't be checked. */
+int cache_validators(const char *key, char *etag, size_t etag_size,
+                     time_t *last_modified)
+{
+    unsigned long long h = hash(HASH_INIT, key);
+    char buf[64];
+    size_t i;
+
+    if (uncacheable)
+        return -1;
+    *last_modified = 0;
+    for (i = 0; i < n_deps; i++) {
+        sprintf(buf, "\n%lld %lld ", deps[i].mtime, deps[i].size);
+        h = hash(hash(h, buf), deps[i].path);
+        if (deps[i].mtime > *last_modified)
+            *last_modified = deps[i].mtime;
+    }
+    snprintf(etag, etag_size, "W/\"%016llx\"", h);
+    return 0;
+}
+
+/* Return a pointer to the next line of buf (NUL-terminating the current
+   one), or NULL if there is none. */
+static char *next_line(char *p, char *end)
+{
+    char *q = memchr(p, '\n', end - p);
+
+    if (q == NULL)
+        return NULL;
+    *q = '\0';
+    return q + 1;
+}
+
+/* If a valid entry for key is in the cache, return the response body
+   (which the caller must free) and set *len to its length; the files
+   listed in the entry become the dependencies of the current response.
+   Otherwise, return NULL. */
+char *cache_fetch(const char *key, size_t *len)
+{
+    char *name, *buf = NULL, *p, *q, *end;
+    struct stat st;
+    long long mtime, size, blen;
+    long n;
+    int fd, off;
+
+    cache_reset();
+    if (cache_dir == NULL || (name = entry_name(key)) == NULL)
+        return NULL;
+    fd = open(name, O_RDONLY);
+    free(name);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(CACHE_MAGIC)
+        || (buf = malloc(st.st_size + 1)) == NULL
+        || read(fd, buf, st.st_size) != st.st_size) {
+        close(fd);
+        free(buf);
+        return NULL;
+    }
+    close(fd);
+    end = buf + st.st_size;
+
+    p = buf;
+    if (memcmp(p, CACHE_MAGIC, sizeof(CACHE_MAGIC) - 1) != 0)
+        goto fail;
+    p += sizeof(CACHE_MAGIC) - 1;
+    if ((q = next_line(p, end)) == NULL || strcmp(p, key) != 0)
+        goto fail;
+    p = q;
+    if ((q = next_line(p, end)) == NULL || (n = atol(p)) < 0)
+        goto fail;
+    for (p = q; n > 0; n--, p = q) {
+        if ((q = next_line(p, end)) == NULL
+            || sscanf(p, "%lld %lld %n", &mtime, &size, &off) != 2)
+            goto fail;
+        if (stat(p + off, &st) != 0) {
+            if (size != -1)
+                goto fail;
+        }
+        else if (st.st_mtime != mtime || st.st_size != size)
+            goto fail;
+        add_dep(p + off, mtime, size);
+    }
+    if ((q = next_line(p, end)) == NULL || (blen = atoll(p)) != end - q)
+        goto fail;
+    memmove(buf, q, blen);
+    *len = blen;
+    return buf;
+
+ fail:
+    cache_reset();
+    free(buf);
+    return NULL;
+}
+
+/* Store the body of the response to the request identified by key,
+   unless one of its dependencies couldn't be checked. */
+void cache_store(const char *key, const char *body, size_t len)
+{
+    char *name, *tmp;
+    FILE *f;
+    size_t i;
+    int fd;
+
+    if (cache_dir == NULL || uncacheable || n_deps == 0
+        || strchr(key, '\n') || (name = entry_name(key)) == NULL)
+        return;
+    if ((tmp = malloc(strlen(name) + 8)) == NULL) {
+        free(name);
+        return;
+    }
+    sprintf(tmp, "%s.XXXXXX", name);
+    if ((fd = mkstemp(tmp)) >= 0) {
+        if ((f = fdopen(fd, "wb")) == NULL)
+            close(fd);
+        else {
+            fputs(CACHE_MAGIC, f);
+            fprintf(f, "%s\n%lu\n", key, (unsigned long) n_deps);
+            for (i = 0; i < n_deps; i++)
+                fprintf(f, "%lld %lld %s\n", deps[i].mtime, deps[i].size,
+                        deps[i].path);
+            fprintf(f, "%lu\n", (unsigned long) len);
+            fwrite(body, 1, len, f);
+            fchmod(fileno(f), 0644);
+            if (fclose(f) == 0 && rename(tmp, name) == 0)
+                tmp[0] = '\0';
+        }
+        if (tmp[0])
+            unlink(tmp);
+    }
+    free(tmp);
+    free(name);
+}
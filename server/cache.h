@@ -0,0 +1,35 @@
+/* file: cache.h	B. Moody	18 October 2026
+
+On-disk response cache for the LightWAVE server
+Copyright (C) 2026 Benjamin Moody
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIGHTWAVE_CACHE_H
+#define LIGHTWAVE_CACHE_H
+
+#include <stddef.h>
+#include <time.h>
+
+int cache_init(const char *dir);
+void cache_reset(void);
+void cache_depend(const char *path);
+void cache_depend_optional(const char *path);
+int cache_validators(const char *key, char *etag, size_t etag_size,
+                     time_t *last_modified);
+char *cache_fetch(const char *key, size_t *len);
+void cache_store(const char *key, const char *body, size_t len);
+
+#endif
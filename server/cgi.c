@@ -54,6 +54,17 @@ void cgi_init(void)
 
 void cgi_end(void)
 {
+    size_t i, j;
+
+    for (i = 0; i < n_query_params; i++) {
+        for (j = 0; j < query_params[i].n_values; j++)
+            free(query_params[i].values[j]);
+        free(query_params[i].values);
+        free(query_params[i].name);
+    }
+    free(query_params);
+    query_params = NULL;
+    n_query_params = 0;
 }
 
 static int xdigitvalue(char c)
@@ -145,13 +156,14 @@ static void parse_param(const char *str, size_t len)
 
 void cgi_process_form(void)
 {
-    const char *qstr;
-    size_t len;
+    cgi_process_query(getenv("QUERY_STRING"));
+}
 
-    query_params = NULL;
-    n_query_params = 0;
+void cgi_process_query(const char *qstr)
+{
+    size_t len;
 
-    qstr = getenv("QUERY_STRING");
+    cgi_end();
     if (!qstr)
         return;
 
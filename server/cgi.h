@@ -23,6 +23,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 void cgi_init(void);
 void cgi_end(void);
 void cgi_process_form(void);
+void cgi_process_query(const char *qstr);
 char *cgi_param(const char *name);
 char *cgi_param_multiple(const char *name);
 
@@ -0,0 +1,412 @@
+/* file: fastcgi.c	B. Moody	18 October 2026
+
+Minimal FastCGI responder for the LightWAVE server
+Copyright (C) 2026 Benjamin Moody
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+This implements only as much of the FastCGI protocol (version 1) as
+is needed to run the LightWAVE server as a long-lived "responder"
+application.  When the web server (e.g. Apache mod_fcgid) starts the
+application, file descriptor 0 is a listening socket rather than a
+pipe.  Requests are handled one at a time; the server doesn't
+multiplex requests over a single connection, and the request body (if
+any) is discarded.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "fastcgi.h"
+
+#define FCGI_LISTENSOCK_FILENO  0
+#define FCGI_VERSION_1          1
+#define FCGI_HEADER_LEN         8
+#define FCGI_MAX_CONTENT        65535
+
+/* record types */
+#define FCGI_BEGIN_REQUEST      1
+#define FCGI_ABORT_REQUEST      2
+#define FCGI_END_REQUEST        3
+#define FCGI_PARAMS             4
+#define FCGI_STDIN              5
+#define FCGI_STDOUT             6
+#define FCGI_GET_VALUES         9
+#define FCGI_GET_VALUES_RESULT  10
+#define FCGI_UNKNOWN_TYPE       11
+
+/* roles, flags and protocol status codes */
+#define FCGI_RESPONDER          1
+#define FCGI_KEEP_CONN          1
+#define FCGI_REQUEST_COMPLETE   0
+#define FCGI_CANT_MPX_CONN      1
+#define FCGI_UNKNOWN_ROLE       3
+
+#define XALLOC0(arr, n) do {                            \
+        void *p_ = calloc((n), sizeof((arr)[0]));       \
+        assert(p_ != NULL);                             \
+        (arr) = p_;                                     \
+    } while (0)
+
+#define XREALLOC(arr, n) do {                              \
+        void *p_ = (arr);                                  \
+        size_t n_ = (n);                                   \
+        size_t m_ = sizeof((arr)[0]);                      \
+        assert(n_ <= ((size_t) -1 / m_));                  \
+        p_ = realloc(p_, n_ * m_);                         \
+        assert(p_ != NULL);                                \
+        (arr) = p_;                                        \
+    } while (0)
+
+static int conn_fd = -1;        /* current connection, or -1 */
+static int keep_conn;           /* true if the web server will reuse conn_fd */
+static int request_id;          /* current request, or 0 if none */
+static int one_conn;            /* true if fcgi_connect has been used */
+
+static unsigned char *param_data; /* raw FCGI_PARAMS stream */
+static size_t param_len, param_size;
+static char **param_names, **param_values;
+static size_t n_params;
+
+int fcgi_is_listener(void)
+{
+    struct sockaddr_storage sa;
+    socklen_t len = sizeof(sa);
+
+    /* A FastCGI application is started with a listening socket on
+       file descriptor 0; getpeername() fails on an unconnected
+       socket, and fails with ENOTSOCK if stdin is a pipe or file. */
+    if (getpeername(FCGI_LISTENSOCK_FILENO, (struct sockaddr *) &sa, &len) == 0
+        || errno != ENOTCONN)
+        return 0;
+    signal(SIGPIPE, SIG_IGN);
+    return 1;
+}
+
+static void close_conn(void)
+{
+    if (conn_fd >= 0)
+        close(conn_fd);
+    conn_fd = -1;
+    request_id = 0;
+}
+
+static int read_all(void *buf, size_t len)
+{
+    unsigned char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        n = read(conn_fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int write_all(const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(conn_fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void write_record(int type, int id, const void *content, size_t len)
+{
+    unsigned char hdr[FCGI_HEADER_LEN];
+
+    if (conn_fd < 0)
+        return;
+    assert(len <= FCGI_MAX_CONTENT);
+    hdr[0] = FCGI_VERSION_1;
+    hdr[1] = type;
+    hdr[2] = (id >> 8) & 0xff;
+    hdr[3] = id & 0xff;
+    hdr[4] = (len >> 8) & 0xff;
+    hdr[5] = len & 0xff;
+    hdr[6] = 0;                 /* padding length */
+    hdr[7] = 0;
+    if (write_all(hdr, sizeof(hdr)) != 0
+        || (len > 0 && write_all(content, len) != 0))
+        close_conn();           /* web server has gone away */
+}
+
+static void end_request(int id, int app_status, int protocol_status)
+{
+    unsigned char body[8] = { 0 };
+
+    body[0] = (app_status >> 24) & 0xff;
+    body[1] = (app_status >> 16) & 0xff;
+    body[2] = (app_status >> 8) & 0xff;
+    body[3] = app_status & 0xff;
+    body[4] = protocol_status;
+    write_record(FCGI_END_REQUEST, id, body, sizeof(body));
+}
+
+static size_t get_length(const unsigned char **p, const unsigned char *end)
+{
+    size_t n;
+
+    if (*p >= end)
+        return (size_t) -1;
+    if (!(**p & 0x80))
+        return *(*p)++;
+    if (end - *p < 4)
+        return (size_t) -1;
+    n = (((size_t) ((*p)[0] & 0x7f) << 24) | ((size_t) (*p)[1] << 16)
+         | ((size_t) (*p)[2] << 8) | (*p)[3]);
+    *p += 4;
+    return n;
+}
+
+static void free_params(void)
+{
+    size_t i;
+
+    for (i = 0; i < n_params; i++) {
+        free(param_names[i]);
+        free(param_values[i]);
+    }
+    free(param_names);
+    free(param_values);
+    param_names = param_values = NULL;
+    n_params = 0;
+    param_len = 0;
+}
+
+/* Split the accumulated FCGI_PARAMS stream into name/value pairs. */
+static void parse_params(void)
+{
+    const unsigned char *p = param_data, *end = param_data + param_len;
+    size_t nlen, vlen;
+
+    while (p < end) {
+        nlen = get_length(&p, end);
+        vlen = get_length(&p, end);
+        if (nlen == (size_t) -1 || vlen == (size_t) -1
+            || nlen > (size_t) (end - p) || vlen > (size_t) (end - p) - nlen)
+            break;
+        XREALLOC(param_names, n_params + 1);
+        XREALLOC(param_values, n_params + 1);
+        XALLOC0(param_names[n_params], nlen + 1);
+        XALLOC0(param_values[n_params], vlen + 1);
+        memcpy(param_names[n_params], p, nlen);
+        memcpy(param_values[n_params], p + nlen, vlen);
+        n_params++;
+        p += nlen + vlen;
+    }
+}
+
+static void get_values(const unsigned char *content, size_t len)
+{
+    static const char *names[] =
+        { "FCGI_MAX_CONNS", "FCGI_MAX_REQS", "FCGI_MPXS_CONNS" };
+    static const char *values[] = { "1", "1", "0" };
+    const unsigned char *p = content, *end = content + len;
+    unsigned char result[256];
+    size_t nlen, vlen, rlen = 0, i;
+
+    while (p < end) {
+        nlen = get_length(&p, end);
+        vlen = get_length(&p, end);
+        if (nlen == (size_t) -1 || vlen == (size_t) -1
+            || nlen > (size_t) (end - p) || vlen > (size_t) (end - p) - nlen)
+            break;
+        for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+            if (strlen(names[i]) == nlen && !memcmp(names[i], p, nlen)
+                && rlen + nlen + 3 < sizeof(result)) {
+                result[rlen++] = nlen;
+                result[rlen++] = 1;
+                memcpy(result + rlen, p, nlen);
+                rlen += nlen;
+                result[rlen++] = values[i][0];
+            }
+        }
+        p += nlen + vlen;
+    }
+    write_record(FCGI_GET_VALUES_RESULT, 0, result, rlen);
+}
+
+/* Wait for a connection from the web server, without reading anything
+   from it.  This is for the sandboxed server, which must accept the
+   connection (using the listening socket) before entering the sandbox,
+   but should read the request only afterwards; fcgi_accept then reads
+   the request from this connection, and doesn't accept another.
+   Returns 0 if successful, or -1 if the listening socket has been
+   closed. */
+int fcgi_connect(void)
+{
+    one_conn = 1;
+    while (conn_fd < 0) {
+        conn_fd = accept(FCGI_LISTENSOCK_FILENO, NULL, NULL);
+        if (conn_fd < 0 && errno != EINTR && errno != ECONNABORTED)
+            return -1;
+    }
+    return 0;
+}
+
+/* Wait for the next request, and read its parameters.  Returns 0 when
+   a request is ready to be handled, or -1 if the listening socket
+   has been closed (or, after fcgi_connect, if the connection has been
+   closed). */
+int fcgi_accept(void)
+{
+    unsigned char hdr[FCGI_HEADER_LEN], pad[256], *content = NULL;
+    int type, id, params_done = 0, stdin_done = 0;
+    size_t len;
+
+    if (request_id)
+        fcgi_finish();
+    free_params();
+
+    XALLOC0(content, FCGI_MAX_CONTENT);
+    while (!params_done || !stdin_done) {
+        if (conn_fd < 0) {
+            params_done = stdin_done = 0;
+            free_params();
+            if (one_conn) {
+                free(content);
+                return -1;
+            }
+            conn_fd = accept(FCGI_LISTENSOCK_FILENO, NULL, NULL);
+            if (conn_fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                free(content);
+                return -1;
+            }
+        }
+
+        if (read_all(hdr, sizeof(hdr)) != 0 || hdr[0] != FCGI_VERSION_1) {
+            close_conn();
+            continue;
+        }
+        type = hdr[1];
+        id = (hdr[2] << 8) | hdr[3];
+        len = (hdr[4] << 8) | hdr[5];
+        if (read_all(content, len) != 0 || read_all(pad, hdr[6]) != 0) {
+            close_conn();
+            continue;
+        }
+
+        if (id == 0) {          /* management record */
+            if (type == FCGI_GET_VALUES)
+                get_values(content, len);
+            else {
+                unsigned char body[8] = { 0 };
+                body[0] = type;
+                write_record(FCGI_UNKNOWN_TYPE, 0, body, sizeof(body));
+            }
+        }
+        else if (type == FCGI_BEGIN_REQUEST) {
+            if (request_id && id != request_id)
+                end_request(id, 0, FCGI_CANT_MPX_CONN);
+            else if (len < 8 || ((content[0] << 8) | content[1])
+                     != FCGI_RESPONDER) {
+                end_request(id, 0, FCGI_UNKNOWN_ROLE);
+                if (len >= 8 && !(content[2] & FCGI_KEEP_CONN))
+                    close_conn();
+            }
+            else {
+                request_id = id;
+                keep_conn = content[2] & FCGI_KEEP_CONN;
+                params_done = stdin_done = 0;
+                free_params();
+            }
+        }
+        else if (id != request_id)
+            ;                   /* stray record for an old request */
+        else if (type == FCGI_ABORT_REQUEST) {
+            end_request(id, 1, FCGI_REQUEST_COMPLETE);
+            request_id = 0;
+            if (!keep_conn)
+                close_conn();
+        }
+        else if (type == FCGI_PARAMS && !params_done) {
+            if (len == 0) {
+                parse_params();
+                params_done = 1;
+            }
+            else {
+                if (param_len + len > param_size) {
+                    param_size = param_len + len + 4096;
+                    XREALLOC(param_data, param_size);
+                }
+                memcpy(param_data + param_len, content, len);
+                param_len += len;
+            }
+        }
+        else if (type == FCGI_STDIN && len == 0)
+            stdin_done = 1;
+    }
+    free(content);
+    return 0;
+}
+
+/* Return the value of a request parameter (the FastCGI equivalent of
+   a CGI environment variable), or NULL if it wasn't given. */
+const char *fcgi_getenv(const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < n_params; i++)
+        if (!strcmp(param_names[i], name))
+            return param_values[i];
+    return NULL;
+}
+
+/* Send data to the web server as part of the response. */
+void fcgi_write(const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    size_t n;
+
+    while (len > 0 && request_id) {
+        n = (len > FCGI_MAX_CONTENT ? FCGI_MAX_CONTENT : len);
+        write_record(FCGI_STDOUT, request_id, p, n);
+        p += n;
+        len -= n;
+    }
+}
+
+/* Mark the end of the response to the current request. */
+void fcgi_finish(void)
+{
+    if (!request_id)
+        return;
+    write_record(FCGI_STDOUT, request_id, NULL, 0);
+    end_request(request_id, 0, FCGI_REQUEST_COMPLETE);
+    request_id = 0;
+    if (!keep_conn)
+        close_conn();
+}
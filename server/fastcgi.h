@@ -0,0 +1,32 @@
+/* file: fastcgi.h	B. Moody	18 October 2026
+
+Minimal FastCGI responder for the LightWAVE server
+Copyright (C) 2026 Benjamin Moody
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIGHTWAVE_FASTCGI_H
+#define LIGHTWAVE_FASTCGI_H
+
+#include <stddef.h>
+
+int fcgi_is_listener(void);
+int fcgi_connect(void);
+int fcgi_accept(void);
+const char *fcgi_getenv(const char *name);
+void fcgi_write(const void *data, size_t len);
+void fcgi_finish(void);
+
+#endif
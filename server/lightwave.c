@@ -1,5 +1,5 @@
 /* file: lightwave.c	G. Moody	18 November 2012
-			Last revised:	  23 April 2019   version 0.68
+			Last revised:	 18 October 2026  version 0.72
 LightWAVE server
 Copyright (C) 2012-2013 George B. Moody
 
@@ -40,10 +40,30 @@ _______________________________________________________________________________
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <math.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <wfdb/wfdblib.h>
 #include <wfdb/ecgcodes.h>
+#include "annidx.h"
+#include "blkcache.h"
+#include "cache.h"
 #include "cgi.h"
+#include "fastcgi.h"
+#include "locate.h"
+#include "meta.h"
+#include "pyramid.h"
+#include "response.h"
 #include "sandbox.h"
+#include "sigread.h"
 #include "setrepos.c"
 
 #ifndef LWDIR
@@ -69,127 +89,841 @@ be integers.  The default value of 0.001 means that the maximum error is
 one part in a thousand (0.1%). */
 #define TOL	0.001
 
+/* ENVMAXDT is the maximum length (in seconds) of the window for which
+fetchenvelopes() will compute signal envelopes, and ENVBLOCK is the number
+of frames that it (like fetchsignals() and find()) reads at a time. */
+#define ENVMAXDT	3600
+#define ENVBLOCK	1024
+
+/* ENVMAXPTS is the largest number of points per signal (npts) that a
+client can ask for in envelopes. */
+#define ENVMAXPTS	100000
+
+/* WFDB_SAMPLE_MIN and WFDB_SAMPLE_MAX are the initial extrema used by
+fetchenvelopes(). */
+#define WFDB_SAMPLE_MIN	INT_MIN
+#define WFDB_SAMPLE_MAX	INT_MAX
+
+/* HISTMAXBINS is the maximum number of bins in a histogram() response, and
+HISTWIDTH is the default width of each bin (in seconds). */
+#define HISTMAXBINS	10000
+#define HISTWIDTH	60
+
+/* SEARCHMAX is the maximum number of matches that search() will return, and
+SEARCHWIN is the length (in seconds) of the first interval that it reads when
+searching backward. */
+#define SEARCHMAX	100
+#define SEARCHWIN	600
+
+/* FINDMAXDT is the maximum length (in seconds) of signal that find() will
+read in answer to one request. */
+#define FINDMAXDT	21600
+
+/* BATCHMAX is the maximum number of items in a batch() request, and
+BATCHJOBS is the maximum number of processes that batch() uses to answer
+them. */
+#define BATCHMAX	64
+#define BATCHJOBS	8
+
+/* STREAMMAXDT is the maximum length (in seconds) of the window for which
+fetchsignals() will send samples in a streamed response (see
+fetchsignals_streamed()), rather than 2 minutes.  It can be changed at run
+time by setting $LIGHTWAVE_STREAMMAXDT. */
+#define STREAMMAXDT	3600
+
+/* RECORD_TTL is the length of time (in seconds) that a record may be kept
+open between requests when running as a FastCGI application. */
+#define RECORD_TTL	60
+
+/* Sample encodings used in binary responses to fetch requests (see
+bin_signal() below). */
+#define BIN_INT16	1	/* raw 16-bit samples */
+#define BIN_INT32	2	/* raw 32-bit samples */
+#define BIN_VARINT	3	/* first differences, as zigzag varints */
+
 static char *action, *annotator[NAMAX], buf[BUFSIZE], *db, *record, *recpath,
     **sname, wfdb_filename[MFNLEN];
-static int interactive, nann, nsig, nosig, *sigmap;
+static int batching, binfmt, binraw, blkcaching, caching, columns, envmean,
+    fastcgi,
+    interactive, nann, nsig, nosig, notmod, *sigmap, streaming, validate;
+static long npts;
+
+/* Annotation paging (see next_annotation): the maximum number of
+   annotations per annotator, the positions given by the client's cursors,
+   and the state of the annotator being read. */
+static long alimit, cursor_k[NAMAX], ann_left, ann_skip_k, ann_last_k;
+static WFDB_Time cursor_t[NAMAX], ann_skip_t, ann_last_t;
+static int ann_more;
+static PYR *pyr;
+static int pyr_checked;
+static SIGREAD *sigrd;
+static int sigrd_checked;
+static WFDB_Time frame_pos;
+
+/* The list of records read by rlist (see read_rlist), and the RECORDS
+   file it was read from, if local. */
+static char *rl_db, **rl_name, *rl_path;
+static long rl_count;
+static time_t rl_read, rl_mtime;
+static off_t rl_size;
+
+/* The full WFDB path, and the narrowed path used for the current request,
+   or NULL if it hasn't been narrowed (see select_db). */
+static char *wfdb_path, *narrow_path;
+
+/* Read-ahead (see note_sequential and read_ahead): the record and interval
+   of the previous fetch of signals, and the interval to be read once the
+   current response has been sent. */
+static char *ra_record;
+static WFDB_Time ra_t0, ra_tf, ra_from, ra_len;
+static RECMETA *meta;
+static int signals_open;
+static time_t record_opened;
 WFDB_FILE *ifile;
 WFDB_Frequency ffreq, tfreq;
 WFDB_Sample *v;
 WFDB_Siginfo *s;
 WFDB_Time t0, tf, dt;
 
-char *get_param(char *name), *get_param_multiple(char *name), *strjson(char *s);
-double approx_LCM(double x, double y);
-int  fetchannotations(void), fetchsignals(void), ufindsig(char *name);
+char *get_param(char *name), *get_param_multiple(char *name), *strjson(char *s),
+    *cache_key(void), *select_db(char *dflt);
+ANNIDX *open_annidx(char *name);
+int next_annotation(ANNIDX *x, WFDB_Annotation *annot, WFDB_Time taf);
+int read_rlist(void), use_envelopes(WFDB_Time dt);
+long read_frames(WFDB_Sample *v, WFDB_Time t, long n);
+const char *request_env(const char *name);
+double approx_LCM(double x, double y), sigscale(int n);
+int  fetchannotations(void), fetchenvelopes(void), fetchpyramid(int level),
+    fetchsignals(void), fetchsignals_streamed(void), ufindsig(char *name),
+    not_modified(void);
 void dblist(void), rlist(void), alist(void), info(void), fetch(void),
+    histogram(void), search(void), find(void), batch(void),
+    batch_item(char *query),
     force_unique_signames(void), print_file(char *filename),
     jsonp_end(void), lwpass(void), lwfail(char *error_message), pnwcheck(void),
-    prep_signals(void), map_signals(void), prep_annotations(void),
-    prep_times(void), cleanup(void);
+    prep_signals(void), read_meta(void), open_signals(void),
+    open_sigread(void), note_sequential(void), read_ahead(void),
+    release_rlist(void),
+    map_signals(void), prep_annotations(void),
+    prep_envelopes(void), prep_times(void),
+    print_sigheader(int n, WFDB_Time ts0, WFDB_Time tsf),
+    print_deltas(WFDB_Sample *x, long n),
+    print_delta_part(WFDB_Sample *x, long n, WFDB_Sample *prev, int first),
+    print_longs(long *x, long n),
+    print_objects(ANNIDX *x, WFDB_Time taf, unsigned char *used),
+    print_columns(ANNIDX *x, WFDB_Time taf, unsigned char *used),
+    print_envelope(int n, WFDB_Time ts0, WFDB_Time tsf, long tpb,
+		   WFDB_Sample *min, WFDB_Sample *max, WFDB_Sample *mean, long nb),
+    bin_begin(int nout), bin_signal(int n, WFDB_Time ts0, WFDB_Time tsf,
+		   long tpb, WFDB_Sample **x, int narr, long count),
+    release_record(void), release_request(void), cleanup(void),
+    lightwave(void), fastcgi_request(void), cached(void (*action_fn)(void)),
+    note_deps(void), note_path_deps(char *name, int all);
 
 int main(int argc, char **argv)
 {
-    static char *callback = NULL, *user;
-    int i;
-    extern int headers_initialized;
-
-    lightwave_sandbox();
+    if (argc >= 2)
+        interactive = 1;  /* interactive mode for debugging */
 
-    if (argc < 2) {  /* normal operation as a CGI application */
-	cgi_init();
-	atexit(cgi_end);
-       	cgi_process_form();
-	printf("Content-type: application/javascript; charset=utf-8\r\n\r\n");
+    /* If the web server started us with a listening socket in place of
+       stdin, run as a FastCGI application. */
+    else if (fcgi_is_listener())
+	fastcgi = 1;
+
+#ifdef SANDBOX
+    /* In the sandboxed server, the request-independent part of the
+       sandbox setup is done once, by a "zygote" process that keeps a
+       pool of children ready to handle requests.  Each child accepts a
+       single connection, then completes the sandbox setup before reading
+       anything from it (the request is read by fastcgi_request below). */
+    if (fastcgi) {
+	lightwave_sandbox_zygote();	/* returns only in a child */
+	if (fcgi_connect() != 0) {
+	    kill(getppid(), SIGTERM);	/* web server has shut us down */
+	    exit(0);
+	}
+	lightwave_sandbox_enter();
     }
     else
-        interactive = 1;  /* interactive mode for debugging */
+#endif
+    lightwave_sandbox();
+
     wfdbquiet();	  /* suppress WFDB library error messages */
     atexit(cleanup);	/* release allocated memory before exiting */
 
     /* Define data sources to be accessed via this server. */
     setrepos();		/* function defined in "setrepos.c" */
+    SSTRCPY(wfdb_path, getwfdb());
+
+#ifndef SANDBOX
+    /* Responses are given validators, made from the files they depend on
+       (see not_modified() below), and if $LIGHTWAVE_CACHE names a
+       directory, responses to listing, info and fetch requests are cached
+       there (see cached() below).  The sandboxed server can't stat or write
+       files, so it does neither. */
+    validate = 1;
+    caching = (cache_init(getenv("LIGHTWAVE_CACHE")) == 0);
+    if (caching) {
+	meta_init(getenv("LIGHTWAVE_CACHE"));
+	annidx_init(getenv("LIGHTWAVE_CACHE"));
+	locate_init(getenv("LIGHTWAVE_CACHE"));
+    }
 
-    if (!(action = get_param("action"))) {
-	print_file(LWDIR "/doc/about.txt");
+    /* If $LIGHTWAVE_BLOCKCACHE names a directory, the parts of remote
+       signal files that have been read are kept there (see blkcache.c),
+       up to $LIGHTWAVE_BLOCKCACHESIZE megabytes in all.  The sandboxed
+       server can't reach remote repositories itself. */
+    {
+	char *p = getenv("LIGHTWAVE_BLOCKCACHESIZE");
+	long long limit = (p && atoll(p) > 0) ? atoll(p) : BLKCACHE_SIZE;
+
+	blkcaching = (blkcache_init(getenv("LIGHTWAVE_BLOCKCACHE"),
+				    limit * 1024 * 1024) == 0);
+    }
+#endif
+
+    if (fastcgi) {
+#ifdef SANDBOX
+	if (fcgi_accept() == 0)
+	    fastcgi_request();
+#else
+	/* Handle one request after another until the web server shuts
+	   us down.  The most recently opened record is kept open between
+	   requests (see prep_signals). */
+	while (fcgi_accept() == 0)
+	    fastcgi_request();
+#endif
+	exit(0);
+    }
+
+    /* normal operation as a CGI application */
+    if (interactive) {
+	lightwave();
 	exit(0);
     }
+    cgi_init();
+    atexit(cgi_end);
+    cgi_process_form();
+    if (response_begin(getenv("HTTP_ACCEPT_ENCODING"), NULL) != 0) exit(1);
+    lightwave();
+    response_end();
+    exit(0);
+}
+
+/* Handle a request received via FastCGI. */
+void fastcgi_request(void)
+{
+    cgi_process_query(fcgi_getenv("QUERY_STRING"));
+    if (response_begin(fcgi_getenv("HTTP_ACCEPT_ENCODING"), fcgi_write) == 0) {
+	lightwave();
+	response_end();
+    }
+    fcgi_finish();
+    read_ahead();
+    release_request();
+}
+
+/* Handle a single request. */
+void lightwave(void)
+{
+    char *callback = NULL, *p;
+
+    cache_reset();
+    action = get_param("action");
+    if (!interactive) {
+	/* The client may ask for signals in binary form (see bin_signal)
+	   rather than as JSON text.  A binary response can't be wrapped in
+	   a JSONP callback, so such a request gets an ordinary JSONP reply. */
+	callback = get_param("callback");
+	if (action && strcmp(action, "fetch") == 0 && callback == NULL &&
+	    (p = get_param("format")) && strcmp(p, "binary") == 0) {
+	    binfmt = 1;
+	    binraw = ((p = get_param("enc")) && strcmp(p, "raw") == 0);
+	    response_header("Content-type", "application/octet-stream");
+	}
+	else
+	    response_header("Content-type",
+			    "application/javascript; charset=utf-8");
+
+	/* A long response may be sent in parts as it is produced (see
+	   response.c), rather than all at once when it is complete. */
+	if ((p = get_param("stream")) && (streaming = (atoi(p) != 0)))
+	    response_stream(1);
+    }
+
+    if (action == NULL) {
+	print_file(LWDIR "/doc/about.txt");
+	return;
+    }
 
-    if (!interactive && (callback = get_param("callback"))) {
+    if (callback) {
 	printf("%s(", callback);	/* JSONP:  "wrap" output in callback */
-	atexit(jsonp_end);	/* close the output with ")" before exiting */
 	if (getenv("LIGHTWAVE_DISABLE_JSONP")) {
 	    lwfail("This server does not allow JSONP requests");
-	    exit(0);
+	    jsonp_end();
+	    return;
 	}
     }
 
     if (strcmp(action, "dblist") == 0)
-	dblist();
+	cached(dblist);
 
-    else if ((db = get_param("db")) == NULL)
+    else if (strcmp(action, "batch") == 0)
+	batch();
+
+    else if (select_db(NULL) == NULL)
 	lwfail("Your request did not specify a database");
   
     else if (strcmp(action, "rlist") == 0)
-	rlist();
+	cached(rlist);
 
     else if (strcmp(action, "alist") == 0)
-	alist();
+	cached(alist);
 
     else if ((record = get_param("record")) == NULL)
 	lwfail("Your request did not specify a record");
 
     else if (strcmp(action, "info") == 0)
-	info();
+	cached(info);
 
     else if (strcmp(action, "fetch") == 0)
-	fetch();
+	cached(fetch);
+
+    else if (strcmp(action, "histogram") == 0)
+	cached(histogram);
+
+    else if (strcmp(action, "search") == 0)
+	cached(search);
+
+    else if (strcmp(action, "find") == 0)
+	cached(find);
 
     else
 	lwfail("Your request did not specify a valid action");
 
-    exit(0);
+    if (callback)
+	jsonp_end();	/* close the output with ")" */
+}
+
+/* Answer the current request using action_fn(), unless a valid response to
+   an equivalent request is in the cache. */
+void cached(void (*action_fn)(void))
+{
+    char *key, *entry;
+    const char *body;
+    size_t len, mark;
+
+    if (!caching || interactive || (key = cache_key()) == NULL) {
+	action_fn();
+	return;
+    }
+    /* A cached entry lists the files it was made from, so the response's
+       validators can be checked without opening the record. */
+    if (entry = cache_fetch(key, &len)) {
+	if (!not_modified())
+	    fwrite(entry, 1, len, stdout);
+	free(entry);
+    }
+    else {
+	mark = response_tell();
+	action_fn();
+	if (!notmod && (body = response_body(mark, &len)))
+	    cache_store(key, body, len);
+    }
+    SFREE(key);
+}
+
+/* Append a field to a cache key (see below). */
+static int key_add(char **key, size_t *len, char *field)
+{
+    size_t n = field ? strlen(field) : 0;
+
+    if (field && strpbrk(field, "\t\n")) return (-1);
+    SREALLOC(*key, *len + n + 2, 1);
+    if (n) memcpy(*key + *len, field, n);
+    (*key)[*len + n] = '\t';
+    (*key)[*len + n + 1] = '\0';
+    *len += n + 1;
+    return (0);
+}
+
+static int compare_strings(const void *a, const void *b)
+{
+    return (strcmp(*(char **)a, *(char **)b));
+}
+
+/* Return the key under which the response to the current request is cached.
+   This is made from the request's parameters, normalized so that equivalent
+   requests have the same key (the order in which signals are listed doesn't
+   matter, for example).  The caller must free the key. */
+char *cache_key(void)
+{
+    static char *option[] = { "t0", "dt", "npts", "mean", "layout", "limit",
+			      "width", "dir", "n", "type", "subtyp", "chan",
+			      "num", "aux", "cond", "level", "tol", "prefix",
+			      "offset" };
+    char *key = NULL, **sig = NULL, *p;
+    int err = 0, i, n = 0;
+    size_t len = 0;
+
+    err |= key_add(&key, &len, action);
+    err |= key_add(&key, &len, db);
+    err |= key_add(&key, &len, getwfdb());	/* see select_db */
+    err |= key_add(&key, &len, record);
+    err |= key_add(&key, &len, binfmt ? (binraw ? "raw" : "binary") : "json");
+    err |= key_add(&key, &len, streaming ? "stream" : "");  /* see prep_times */
+    for (i = 0; i < sizeof(option)/sizeof(option[0]); i++)
+	err |= key_add(&key, &len, get_param(option[i]));
+    while (p = get_param_multiple("signal")) {
+	SREALLOC(sig, n + 1, sizeof(char *));
+	sig[n++] = p;
+    }
+    if (n > 1) qsort(sig, n, sizeof(char *), compare_strings);
+    for (i = 0; i < n; i++)
+	if (i == 0 || strcmp(sig[i], sig[i-1]))
+	    err |= key_add(&key, &len, sig[i]);
+    err |= key_add(&key, &len, "");	/* annotators follow, in order */
+    while (p = get_param_multiple("annotator"))
+	err |= key_add(&key, &len, p);
+    err |= key_add(&key, &len, "");	/* then cursors, in order */
+    while (p = get_param_multiple("cursor"))
+	err |= key_add(&key, &len, p);
+    SFREE(sig);
+    if (err) SFREE(key);
+    return (key);
+}
+
+/* Set db to the database named in the current request (or to dflt, if
+   none is named), and narrow the WFDB path to the components that hold it
+   (see locate.c), so that the WFDB library doesn't look for its files in
+   the others.  The full path is restored by release_request.  Returns db. */
+char *select_db(char *dflt)
+{
+    char *p;
+
+    if ((db = get_param("db")) == NULL) db = dflt;
+    if (db && (p = locate_db(wfdb_path, db))) {
+	SSTRCPY(narrow_path, p);
+	free(p);
+	setwfdb(narrow_path);
+    }
+    return (db);
+}
+
+/* Return the value of a request header or other CGI variable. */
+const char *request_env(const char *name)
+{
+    return (fastcgi ? fcgi_getenv(name) : getenv(name));
+}
+
+/* Add validators (ETag and Last-Modified headers) to the response to the
+   current request, made from the request's parameters and the files noted
+   by cache_depend().  Return 1 if the client's If-None-Match or
+   If-Modified-Since header shows that it already has the current version
+   of the response, in which case the caller should not produce the body
+   (the server sends "304 Not Modified" instead). */
+int not_modified(void)
+{
+    char etag[64], *key, *p;
+    size_t len;
+    time_t mtime;
+
+    notmod = 0;
+    if (!validate || interactive || (key = cache_key()) == NULL)
+	return (0);
+    len = strlen(key);
+    /* The same record may be requested with different callbacks, and the
+       output of another version of the server may differ. */
+    if (key_add(&key, &len, LWVER) ||
+	key_add(&key, &len, get_param("callback"))) {
+	SFREE(key);
+	return (0);
+    }
+    /* The list of databases may come from the environment (see dblist). */
+    if (strcmp(action, "dblist") == 0 && (p = getenv("LIGHTWAVE_DBLIST"))) {
+	SREALLOC(key, len + strlen(p) + 1, 1);
+	strcpy(key + len, p);
+    }
+    if (cache_validators(key, etag, sizeof(etag), &mtime) == 0)
+	notmod = response_validate(etag, mtime,
+				   request_env("HTTP_IF_NONE_MATCH"),
+				   request_env("HTTP_IF_MODIFIED_SINCE"));
+    SFREE(key);
+    return (notmod);
+}
+
+/* Tell the cache which local files the response to the current request is
+   made from, so that a cached copy of the response can be discarded, and
+   the response's validators change (see not_modified), if any of them
+   change. */
+void note_deps(void)
+{
+    char *p, *q;
+    int i, n;
+
+    if (!validate) return;
+    cache_depend(meta ? meta->hea : NULL);
+
+    /* Multi-segment records depend on the segments' headers too, so
+       their responses are not cached. */
+    if (meta == NULL || meta->nseg > 0) cache_depend(NULL);
+
+    /* Signal file names in the header are relative to the directory
+       containing the header. */
+    for (n = 0; n < nsig; n++) {
+	if (sigmap == NULL || sigmap[n] < 0 || strcmp(s[n].fname, "~") == 0)
+	    continue;
+	SUALLOC(p, strlen(recpath) + strlen(s[n].fname) + 2, sizeof(char));
+	strcpy(p, recpath);
+	if (q = strrchr(p, '/')) strcpy(q+1, s[n].fname);
+	else strcpy(p, s[n].fname);
+	if ((q = wfdbfile(p, NULL)) == NULL)
+	    q = wfdbfile(s[n].fname, NULL);
+	cache_depend(q);
+	SFREE(p);
+    }
+    for (i = 0; i < nann; i++)
+	cache_depend(wfdbfile(annotator[i], recpath));
+    /* Envelopes depend on the pyramid file, or on its absence (see
+       prep_envelopes), so that building one changes the response. */
+    if (npts > 0) {
+	SUALLOC(p, strlen(recpath) + strlen(PYR_SUFFIX) + 2, sizeof(char));
+	sprintf(p, "%s.%s", recpath, PYR_SUFFIX);
+	note_path_deps(p, 0);
+	SFREE(p);
+    }
+}
+
+/* Tell the cache that the response to the current request is made from
+   the named file in each location in the WFDB path (or, unless all is
+   true, from the first such file found).  Since files that aren't local
+   can't be checked, a response that may depend on them has no
+   validators. */
+void note_path_deps(char *name, int all)
+{
+    char *next, *p, *wfdb, *wfdbpath = NULL;
+    int found;
+
+    if (!validate) return;
+    SSTRCPY(wfdbpath, getwfdb());
+    for (wfdb = wfdbpath; *wfdb; wfdb = next) {
+	for (next = wfdb; *next && *next != ' '; next++)
+	    ;
+	if (*next) *next++ = '\0';
+	if (*wfdb == '\0') continue;
+	if (strstr(wfdb, "://")) {
+	    cache_depend(NULL);
+	    break;
+	}
+	SUALLOC(p, strlen(wfdb) + strlen(name) + 2, sizeof(char));
+	sprintf(p, "%s/%s", wfdb, name);
+	found = (access(p, F_OK) == 0);
+	cache_depend_optional(p);
+	SFREE(p);
+	if (found && !all) break;
+    }
+    SFREE(wfdbpath);
 }
 
 void prep_signals()
 {
-    int n;
+    char *p;
+
+    SUALLOC(p, strlen(db) + strlen(record) + 2, sizeof(char));
+    sprintf(p, "%s/%s", db, record);
+
+    /* In FastCGI mode, reuse the record opened by a previous request if
+       it is the same one and it was opened recently enough that its
+       header is unlikely to have changed.  The items of a batch request
+       (see batch) do the same. */
+    if ((fastcgi || batching) && recpath && strcmp(p, recpath) == 0 && nsig > 0 &&
+	time(NULL) - record_opened < RECORD_TTL) {
+	SFREE(p);
+	if (signals_open) setgvmode(WFDB_LOWRES);
+	return;
+    }
+    release_record();
+    recpath = p;
+    record_opened = time(NULL);
+
+    /* If the record's metadata were saved by an earlier request (see
+       meta.c), use them; the record itself isn't opened until samples or
+       annotations are needed (see open_signals). */
+    if (meta = meta_load(recpath)) {
+	nsig = meta->nsig;
+	s = meta->s;
+	sname = meta->sname;
+	ffreq = meta->ffreq;
+	tfreq = meta->tfreq;
+    }
+    else
+	read_meta();
+}
 
-    SUALLOC(recpath, strlen(db) + strlen(record) + 2, sizeof(char));
-    sprintf(recpath, "%s/%s", db, record);
+/* Open the current record and collect its metadata (saving them for later
+   requests if possible).  On return, the signals are open, unless nsig is
+   negative (if the header couldn't be read). */
+void read_meta(void)
+{
+    char *p;
+    int n;
+    WFDB_Seginfo *seg;
+    WFDB_Siginfo *si = NULL;
+    WFDB_Time t;
 
     /* Discover the number of signals defined in the header, allocate
-       memory for their signal information structures, open the signals. */
-    if ((nsig = isigopen(recpath, NULL, 0)) > 0) {
-	SUALLOC(s, nsig, sizeof(WFDB_Siginfo));
-	nsig = isigopen(recpath, s, nsig);
-    } 
+       memory for their signal information structures, open the signals.
+       A record that was recently found to be missing isn't looked for
+       again, and one that isn't found in the narrowed WFDB path is looked
+       for in the full path (see select_db) before it is noted as missing. */
+    if (locate_missing(wfdb_path, recpath))
+	nsig = -1;
     else {
+	if ((nsig = isigopen(recpath, NULL, 0)) == -1 && narrow_path) {
+	    setwfdb(wfdb_path);
+	    if ((nsig = isigopen(recpath, NULL, 0)) == -1)
+		setwfdb(narrow_path);
+	    else {
+		locate_everywhere(wfdb_path, db);
+		SFREE(narrow_path);
+	    }
+	}
+	if (nsig == -1)
+	    locate_note_missing(wfdb_path, recpath);
+    }
+    if (nsig > 0) {
+	SUALLOC(si, nsig, sizeof(WFDB_Siginfo));
+	nsig = isigopen(recpath, si, nsig);
+    }
+    if (nsig < 0) {
+	SFREE(si);
+	tfreq = ffreq = sampfreq(NULL);
+	return;
+    }
+    signals_open = 1;
+
+    /* Make a copy of the signal information that belongs to meta (and so
+       is still valid after the record is closed). */
+    SUALLOC(meta, 1, sizeof(RECMETA));
+    meta->nsig = nsig;
+    SALLOC(meta->s, nsig ? nsig : 1, sizeof(WFDB_Siginfo));
+    SALLOC(meta->scale, nsig ? nsig : 1, sizeof(double));
+    for (n = 0; n < nsig; n++) {
+	meta->s[n] = si[n];
+	meta->s[n].fname = meta->s[n].desc = meta->s[n].units = NULL;
+	SSTRCPY(meta->s[n].fname, si[n].fname);
+	SSTRCPY(meta->s[n].desc, si[n].desc);
+	SSTRCPY(meta->s[n].units, si[n].units);
+    }
+    SFREE(si);
+    s = meta->s;
+
+    if (nsig > 0) {
+	/* Shorten signal names of the form "record xxx, signal N" to "v[N]" */
+	for (n = 0; n < nsig; n++) {
+	    if (strncmp(s[n].desc, "record ", 7) == 0) {
+		SFREE(s[n].desc);
+		SUALLOC(s[n].desc, 16, sizeof(char));
+		sprintf(s[n].desc, "v[%d]", n);
+	    }
+	}
+
+	/* Make reasonably sure that signal names are distinct (see below). */
+	force_unique_signames();
+
+	/* Find the least common multiple of the sampling frequencies (which
+	   may not be exactly expressible as floating-point numbers).  In
+	   WFDB-compatible records, all signals are sampled at the same
+	   frequency or at a multiple of the frame frequency, but (especially
+	   in EDF records) there may be many samples of each signal in each
+	   frame.  The for loop below sets the "tick" frequency, tfreq, to the
+	   number of instants in each second when at least one sample is
+	   acquired. */
+	setgvmode(WFDB_LOWRES);
+	ffreq = sampfreq(NULL);
+	if (ffreq <= 0.) ffreq = WFDB_DEFFREQ;
+	for (n = 0, tfreq = ffreq; n < nsig; n++)
+	    tfreq = approx_LCM(ffreq * s[n].spf, tfreq);
+
+	/* Look up the signals' scale factors in the calibration database
+	   (which may be in a component of the WFDB path that doesn't hold
+	   the record; see select_db). */
+	if (narrow_path) setwfdb(wfdb_path);
+	(void)calopen(NULL);
+	if (narrow_path) setwfdb(narrow_path);
+	for (n = 0; n < nsig; n++) {
+	    WFDB_Calinfo cal;
+
+	    meta->scale[n] = (getcal(sname[n], s[n].units, &cal) == 0) ?
+		cal.scale : 1.0;
+	}
+    }
+    else
 	tfreq = ffreq = sampfreq(NULL);
+    SALLOC(meta->sname, nsig ? nsig : 1, sizeof(char *));
+    for (n = 0; n < nsig; n++)
+	meta->sname[n] = sname[n];
+    SFREE(sname);
+    sname = meta->sname;
+    meta->ffreq = ffreq;
+    meta->tfreq = tfreq;
+
+    /* Collect the information needed by info(). */
+    p = timstr(0);
+    if (*p == '[') {
+	SSTRCPY(meta->start, mstimstr(0L));
+	SSTRCPY(meta->end, mstimstr(-strtim("e")));
+    }
+    t = strtim("e");
+    if (t > (WFDB_Time)0) {
+	p = mstimstr(t);
+	while (*p == ' ') p++;
+	SSTRCPY(meta->duration, p);
+    }
+    for (p = getinfo(recpath); p; p = getinfo((char *)NULL)) {
+	SREALLOC(meta->note, meta->nnote + 1, sizeof(char *));
+	meta->note[meta->nnote] = NULL;
+	SSTRCPY(meta->note[meta->nnote], p);
+	meta->nnote++;
+    }
+
+    SSTRCPY(meta->hea, wfdbfile("hea", recpath));
+    meta->nseg = ((n = getseginfo(&seg)) > 0) ? n : 0;
+    meta_save(meta, recpath);
+}
+
+/* Open the signals of the current record, if prep_signals didn't. */
+void open_signals(void)
+{
+    WFDB_Siginfo *si = NULL;
+
+    if (signals_open || nsig < 0) return;
+    if (nsig > 0) SUALLOC(si, nsig, sizeof(WFDB_Siginfo));
+    if (isigopen(recpath, si, nsig) == nsig) {
+	signals_open = 1;
+	setgvmode(WFDB_LOWRES);
+	SFREE(si);
 	return;
     }
+    SFREE(si);
+
+    /* The header doesn't match the saved metadata, so start over. */
+    meta_free(meta);
+    meta = NULL;
+    s = NULL;
+    sname = NULL;
+    read_meta();
+}
 
-    /* Shorten signal names of the form "record xxx, signal N" to "v[N]" */
+/* Prepare to decode the signals of the current record directly from its
+   signal files (see sigread.c), if they are local files in one of the
+   formats that sigread understands.  The signal files are found in the
+   same way as in note_deps; those of a multi-segment record are found by
+   sigread itself, next to the segment headers.  Remote signal files are
+   read through the block cache, if it is enabled, and are assumed to be
+   next to the header (as the WFDB library looks for them there first). */
+void open_sigread(void)
+{
+    char **path, *p, *q;
+    int n, remote;
+
+    sigrd_checked = 1;
+    if (meta == NULL || meta->hea == NULL || nsig < 1)
+	return;
+    remote = (strstr(meta->hea, "://") != NULL);
+    if (remote && !blkcaching)
+	return;
+    if (meta->nseg > 0) {
+	sigrd = sigread_open(meta->hea, s, nsig, NULL);
+	return;
+    }
+    SUALLOC(path, nsig, sizeof(char *));
     for (n = 0; n < nsig; n++) {
-	if (strncmp(s[n].desc, "record ", 7) == 0)
-	    sprintf(s[n].desc, "v[%d]", n);
-    }
-
-    /* Make reasonably sure that signal names are distinct (see below). */
-    force_unique_signames();
-
-    /* Find the least common multiple of the sampling frequencies (which may not
-       be exactly expressible as floating-point numbers).  In WFDB-compatible
-       records, all signals are sampled at the same frequency or at a multiple
-       of the frame frequency, but (especially in EDF records) there may be many
-       samples of each signal in each frame.  The for loop below sets the "tick"
-       frequency, tfreq, to the number of instants in each second when at least
-       one sample is acquired. */
-    setgvmode(WFDB_LOWRES);
-    ffreq = sampfreq(NULL);
-    if (ffreq <= 0.) ffreq = WFDB_DEFFREQ;
-    for (n = 0, tfreq = ffreq; n < nsig; n++)
-	tfreq = approx_LCM(ffreq * s[n].spf, tfreq);
-}   
+	if (strcmp(s[n].fname, "~") == 0 || strcmp(s[n].fname, "-") == 0)
+	    break;
+	if (remote) {
+	    SUALLOC(path[n], strlen(meta->hea) + strlen(s[n].fname) + 1,
+		    sizeof(char));
+	    strcpy(path[n], meta->hea);
+	    strcpy(strrchr(path[n], '/') + 1, s[n].fname);
+	    continue;
+	}
+	SUALLOC(p, strlen(recpath) + strlen(s[n].fname) + 2, sizeof(char));
+	strcpy(p, recpath);
+	if (q = strrchr(p, '/')) strcpy(q+1, s[n].fname);
+	else strcpy(p, s[n].fname);
+	if ((q = wfdbfile(p, NULL)) == NULL)
+	    q = wfdbfile(s[n].fname, NULL);
+	SFREE(p);
+	if (q == NULL) break;
+	SSTRCPY(path[n], q);
+    }
+    if (n == nsig)
+	sigrd = sigread_open(meta->hea, s, nsig, path);
+    for (n = 0; n < nsig; n++)
+	SFREE(path[n]);
+    SFREE(path);
+}
+
+/* Read up to n frames of the current record, beginning with frame t, into
+   v.  The frames are decoded directly from the signal files if possible,
+   and otherwise read using getframe.  Returns the number of frames read,
+   which is less than n only at the end of the record. */
+long read_frames(WFDB_Sample *v, WFDB_Time t, long n)
+{
+    int framelen, i;
+    long k = 0;
+
+    if (!sigrd_checked) open_sigread();
+    if (sigrd) k = sigread_frames(sigrd, t, n, v);
+    if (k < n) {
+	for (i = framelen = 0; i < nsig; i++)
+	    framelen += s[i].spf;
+	if (frame_pos != t + k && isigsettime(t + k) < 0) {
+	    frame_pos = -1;
+	    return (k);
+	}
+	for (v += k * framelen; k < n && getframe(v) > 0; k++)
+	    v += framelen;
+	frame_pos = (k < n) ? -1 : t + k;
+    }
+    return (k);
+}
+
+/* Note the interval of a fetch of signals.  If it continues the previous
+   fetch from the same record (beginning after the start of that one, and
+   no later than its end), the client is probably moving forward through the
+   record, as it does when scrolling or in autoplay, so the following
+   interval of the same length is marked to be read ahead.  Envelopes read
+   from a pyramid file don't need the samples. */
+void note_sequential(void)
+{
+    ra_len = 0;
+    if (nosig < 1 || t0 >= tf || (npts > 0 && pyr)) return;
+    if (ra_record && strcmp(ra_record, recpath) == 0 &&
+	t0 > ra_t0 && t0 <= ra_tf) {
+	ra_from = tf;
+	ra_len = tf - t0;
+    }
+    SSTRCPY(ra_record, recpath);
+    ra_t0 = t0;
+    ra_tf = tf;
+}
+
+/* Read ahead the interval marked by note_sequential, after the response
+   has been sent (and while the client is busy drawing it), so that the
+   next request finds its samples in the page cache, or for a remote
+   record, in the block cache (see sigread_prefetch).  Only a FastCGI
+   server that isn't sandboxed handles more than one request, and so can
+   notice sequential access. */
+void read_ahead(void)
+{
+    if (ra_len > 0 && recpath && strcmp(recpath, ra_record) == 0) {
+	if (!sigrd_checked) open_sigread();
+	if (sigrd) sigread_prefetch(sigrd, ra_from, ra_len);
+    }
+    ra_len = 0;
+}
 
 void lwpass()
 {
@@ -213,7 +947,7 @@ void map_signals()
     for (n = 0; n < nsig; n++)
 	sigmap[n] = -1;
     while (p = get_param_multiple("signal")) {
-	if ((n = ufindsig(p)) >= 0) {
+	if ((n = ufindsig(p)) >= 0 && sigmap[n] < 0) {
 	    sigmap[n] = n; n++; nosig++;
 	}
     }
@@ -222,16 +956,59 @@ void map_signals()
 void prep_annotators()
 {
     char *p;
+    int i;
+    long t, k;
 
     while (nann < NAMAX && (p = get_param_multiple("annotator"))) {
 	SSTRCPY(annotator[nann], p);
 	nann++;
     }
+
+    /* The client may ask for annotations as parallel arrays rather than
+       as an array of objects (see print_columns). */
+    if (!interactive && (p = get_param("layout")))
+	columns = (strcmp(p, "columns") == 0);
+
+    /* The client may ask for no more than alimit annotations from each
+       annotator, and then for the next alimit, and so on, by passing back
+       the cursors returned with each part (see next_annotation). */
+    for (i = 0; i < NAMAX; i++)
+	cursor_t[i] = -1;
+    if (!interactive) {
+	if ((p = get_param("limit")) && (alimit = atol(p)) < 0) alimit = 0;
+	for (i = 0; p = get_param_multiple("cursor"); i++)
+	    if (i < NAMAX && sscanf(p, "%ld.%ld", &t, &k) == 2 && t >= 0 &&
+		k >= 0) {
+		cursor_t[i] = t;
+		cursor_k[i] = k;
+	    }
+    }
+}
+
+void prep_envelopes()
+{
+    char *p;
+
+    /* These parameters are not prompted for in interactive mode, so that
+       scripts written for older versions (such as check/lw-test) still
+       work. */
+    if (!interactive && (p = get_param("npts")) && (npts = atol(p)) < 0)
+	npts = 0;
+    if (npts > ENVMAXPTS) npts = ENVMAXPTS;
+    if (!interactive && (p = get_param("mean"))) envmean = (atoi(p) != 0);
+
+    /* If the record has a pyramid file, fetchpyramid() can use it to
+       produce envelopes without reading the samples. */
+    if (npts > 0 && nsig > 0 && !pyr_checked) {
+	pyr = pyr_open(recpath, s, nsig);
+	pyr_checked = 1;
+    }
 }
 
 void prep_times()
 {
     char *p;
+    int level;
 
     if ((p = get_param("t0")) == NULL) p = "0";
     if ((t0 = strtim(p)) < 0L) t0 = -t0;
@@ -251,17 +1028,61 @@ void prep_times()
        * Otherwise, if dt is longer than 2 minutes and longer than 120000 sample
        intervals, it is reduced to 2 minutes, to limit the load on the server
        from a single request.
+
+       * If the client has asked for signal envelopes (npts > 0), and the
+       window is long enough that envelopes will be sent rather than
+       samples (see use_envelopes), the size of the response doesn't
+       depend on dt, so the limit is ENVMAXDT seconds rather than 2
+       minutes.  If the envelopes can be read from a pyramid file, the
+       cost of doing so doesn't depend on dt either, so the only limit
+       is that the window may hold no more than npts buckets of the
+       pyramid level that is used.
+
+       * If the response is streamed (and not binary), the memory needed
+       doesn't depend on dt (see fetchsignals_streamed), so the limit is
+       STREAMMAXDT seconds (or $LIGHTWAVE_STREAMMAXDT) rather than 2
+       minutes.
     */
     dt = atoi(p);
     if (dt <= 0) dt = 0;
     else {
 	dt *= ffreq;
 	if (dt < 1) dt = 1;
+	else if (npts > 0 && pyr && (level = pyr_level(pyr, dt, npts)) >= 0) {
+	    if (dt > npts * pyr_bucket(pyr, level))
+		dt = npts * pyr_bucket(pyr, level);
+	}
+	else if (npts > 0 && use_envelopes(dt > ENVMAXDT*ffreq && dt > 120000 ?
+					   ENVMAXDT*ffreq : dt)) {
+	    if (dt > ENVMAXDT*ffreq && dt > 120000) dt = ENVMAXDT*ffreq;
+	}
+	else if (streaming && !binfmt) {
+	    double maxdt = STREAMMAXDT;
+
+	    if ((p = getenv("LIGHTWAVE_STREAMMAXDT")) && atof(p) > 0.)
+		maxdt = atof(p);
+	    if (dt > maxdt*ffreq && dt > 120000) dt = maxdt*ffreq;
+	}
 	else if (dt > 120*ffreq && dt > 120000) dt = 120*ffreq;
     }
     tf = t0 + dt;
 }
 
+/* Return true if fetchsignals() sends envelopes rather than samples for a
+   window of dt frames: that is, if the client has asked for no more than
+   npts points per signal, and any requested signal has more samples than
+   that in the window. */
+int use_envelopes(WFDB_Time dt)
+{
+    int n;
+
+    if (npts > 0)
+	for (n = 0; n < nsig; n++)
+	    if (sigmap[n] >= 0 && dt*s[n].spf > npts)
+		return (1);
+    return (0);
+}
+
 /* Find the (approximate) least common multiple of two positive numbers
    (which are not necessarily integers). */
 double approx_LCM(double x, double y)
@@ -393,12 +1214,22 @@ void jsonp_end(void)
 
 void dblist(void)
 {
-    char *next, *wfdb = getwfdb(), *list;
+    char *next, *wfdb, *wfdbpath = NULL, *list, *dbs = NULL;
     int first = 1;
 
+    if (getenv("LIGHTWAVE_DBLIST") == NULL) note_path_deps("DBS", 1);
+    if (not_modified()) return;
+
+    /* The loops below modify the strings they are parsing, so work with
+       copies (the originals are still needed in FastCGI mode). */
+    SSTRCPY(wfdbpath, getwfdb());
+    wfdb = wfdbpath;
+
     /* If $LIGHTWAVE_DBLIST is set, the value of this variable
        contains the list of available databases. */
     if ((list = getenv("LIGHTWAVE_DBLIST"))) {
+	SSTRCPY(dbs, list);
+	list = dbs;
 	while (list) {
 	    char *p, *name, *desc;
 	    next = strchr(list, '\n');
@@ -456,6 +1287,8 @@ void dblist(void)
 	}
 	wfdb = next;  /* prepare to search the next location in the WFDB path */
     }
+    SFREE(dbs);
+    SFREE(wfdbpath);
     if (!first) {
 	printf("\n  ],\n");
 	printf("  \"version\": \"%s\",\n", LWVER);
@@ -466,33 +1299,123 @@ void dblist(void)
     }
 }
 
-void rlist(void)
+/* Read the list of records in the current database into rl_name, unless
+   the same list was read by an earlier request (in FastCGI mode).  A list
+   read from a local RECORDS file is kept as long as the file (the first
+   found in the WFDB path) has the same modification time and size, as the
+   response cache checks it; one read from a remote file is kept for
+   RECORD_TTL seconds, as a record is kept open (see prep_signals).
+   Returns 0 if successful, or -1 if the list can't be read. */
+int read_rlist(void)
 {
+    char *p;
+    int n;
+    struct stat st;
+
     sprintf(buf, "%s/RECORDS", db);
-    if (ifile = wfdb_open(buf, NULL, WFDB_READ)) {
-	char *p;
-        int first = 1;
-
-        printf("{ \"record\": [\n");
-	while (wfdb_fgets(buf, sizeof(buf), ifile)) {
-	    buf[strlen(buf)-1] = '\0';
-	    if (!first) printf(",\n");
-	    else first = 0;
-	    printf("    %s", p = strjson(buf));
-	    SFREE(p);
-	}
-	printf("\n  ],\n");
-	lwpass();
-	wfdb_fclose(ifile);
+    if ((p = wfdbfile(buf, NULL)) && strstr(p, "://") == NULL &&
+	stat(p, &st) == 0) {
+	if (rl_db && strcmp(rl_db, db) == 0 && rl_path &&
+	    strcmp(rl_path, p) == 0 && st.st_mtime == rl_mtime &&
+	    st.st_size == rl_size)
+	    return (0);
     }
-    else
+    else {
+	p = NULL;
+	if (rl_db && strcmp(rl_db, db) == 0 && rl_path == NULL &&
+	    time(NULL) - rl_read < RECORD_TTL)
+	    return (0);
+    }
+    release_rlist();
+    if (p) {
+	SSTRCPY(rl_path, p);
+	rl_mtime = st.st_mtime;
+	rl_size = st.st_size;
+    }
+    if ((ifile = wfdb_open(buf, NULL, WFDB_READ)) == NULL)
+	return (-1);
+    while (wfdb_fgets(buf, sizeof(buf), ifile)) {
+	if ((n = strlen(buf)) > 0 && buf[n-1] == '\n') buf[n-1] = '\0';
+	if (rl_count % 1024 == 0)
+	    SREALLOC(rl_name, rl_count + 1024, sizeof(char *));
+	rl_name[rl_count] = NULL;
+	SSTRCPY(rl_name[rl_count], buf);
+	rl_count++;
+    }
+    wfdb_fclose(ifile);
+    SSTRCPY(rl_db, db);
+    rl_read = time(NULL);
+    return (0);
+}
+
+void release_rlist(void)
+{
+    while (rl_count > 0) {
+	rl_count--;
+	SFREE(rl_name[rl_count]);
+    }
+    SFREE(rl_name);
+    SFREE(rl_db);
+    SFREE(rl_path);
+}
+
+/* List the records of a database.  If the request includes a prefix,
+   only the records whose names begin with it are listed; if it includes
+   an offset or limit, only that part of the list is sent, together with
+   the total number of records (matching the prefix) and, if there are
+   more, the offset of the next part. */
+void rlist(void)
+{
+    char *p, *prefix;
+    long i, limit, offset, total;
+    int first = 1, paged;
+    size_t plen;
+
+    sprintf(buf, "%s/RECORDS", db);
+    note_path_deps(buf, 0);
+    if (not_modified()) return;
+    if (read_rlist() < 0) {
 	lwfail("The list of records could not be read");
+	return;
+    }
+    prefix = get_param("prefix");
+    plen = prefix ? strlen(prefix) : 0;
+    if ((p = get_param("offset")) == NULL || (offset = atol(p)) < 0)
+	offset = 0;
+    if ((p = get_param("limit")) == NULL || (limit = atol(p)) < 0)
+	limit = 0;	/* no limit */
+    paged = (prefix || get_param("offset") || limit > 0);
+
+    printf("{ \"record\": [\n");
+    for (i = total = 0; i < rl_count; i++) {
+	if (plen && strncmp(rl_name[i], prefix, plen)) continue;
+	if (total++ < offset || (limit > 0 && total > offset + limit))
+	    continue;
+	if (!first) printf(",\n");
+	else first = 0;
+	printf("    %s", p = strjson(rl_name[i]));
+	SFREE(p);
+    }
+    printf("\n  ],\n");
+    if (paged) {
+	printf("  \"total\": %ld,\n", total);
+	if (limit > 0 && total > offset + limit)
+	    printf("  \"next\": %ld,\n", offset + limit);
+    }
+    lwpass();
 }
 
 void alist(void)
 {
-    char *next, *wfdb = getwfdb();
+    char *next, *wfdb, *wfdbpath = NULL;
     int first = 1, mfnlen = MFNLEN - strlen(db) - 12;
+
+    sprintf(buf, "%s/ANNOTATORS", db);
+    note_path_deps(buf, 1);
+    if (not_modified()) return;
+
+    SSTRCPY(wfdbpath, getwfdb());
+    wfdb = wfdbpath;
    
     while (*wfdb) {
 	/* Isolate the next component of the WFDB path. */
@@ -527,6 +1450,7 @@ void alist(void)
 	}
 	wfdb = next;  /* prepare to search the next location in the WFDB path */
     }
+    SFREE(wfdbpath);
     if (!first) {
 	printf("\n  ],\n");
 	lwpass();
@@ -537,34 +1461,30 @@ void alist(void)
 
 void info(void)
 {
-    char *info, *p;
+    char *p;
     int i;
-    WFDB_Time t;
 
     prep_signals();
     if (nsig < 0) {
 	lwfail("The '.hea' file could not be read");
 	return;
     }
+    note_deps();
+    if (not_modified()) return;
     printf("{ \"info\":\n");
     printf("  { \"db\": %s,\n", p = strjson(db)); SFREE(p);
     printf("    \"record\": %s,\n", p = strjson(record)); SFREE(p);
     printf("    \"tfreq\": %g,\n", tfreq);
-    p = timstr(0);
-    if (*p == '[') {
-        printf("    \"start\": \"%s\",\n", mstimstr(0L));
-	printf("    \"end\": \"%s\",\n", mstimstr(-strtim("e")));
+    if (meta->start) {
+        printf("    \"start\": \"%s\",\n", meta->start);
+	printf("    \"end\": \"%s\",\n", meta->end);
     }
     else {
         printf("    \"start\": null,\n");
 	printf("    \"end\": null,\n");
     }
-    t = strtim("e");
-    if (t > (WFDB_Time)0) {
-	p = mstimstr(t);
-	while (*p == ' ') p++;
-	printf("    \"duration\": \"%s\",\n", p);
-    }
+    if (meta->duration)
+	printf("    \"duration\": \"%s\",\n", meta->duration);
     else
 	printf("    \"duration\": null,\n");
 
@@ -590,10 +1510,10 @@ void info(void)
     else
 	printf("    \"signal\": null,\n");
 
-    if (info = getinfo(recpath)) {
-	printf("    \"note\": [\n      %s", p = strjson(info));
-	while (info = getinfo((char *)NULL)) {
-	    printf(",\n      %s", p = strjson(info));
+    if (meta->nnote > 0) {
+	for (i = 0; i < meta->nnote; i++) {
+	    printf("%s      %s", i ? ",\n" : "    \"note\": [\n",
+		   p = strjson(meta->note[i]));
 	    SFREE(p);
 	}
 	printf("\n    ]\n");
@@ -629,37 +1549,34 @@ int fetchannotations(void)
 	if (annopen(recpath, &ai, 1) >= 0) {
 	    char *p;
 	    int first = 1;
-	    WFDB_Annotation annot;
 	    unsigned char used[ACMAX + 1] = { 0 };
 	    int j, k;
-
-	    if (ta0 > 0L) iannsettime(ta0);
+	    ANNIDX *x = open_annidx(annotator[i]);
+	    WFDB_Time ts = ta0;
+
+	    /* Resume where the previous part ended, if there is a cursor. */
+	    ann_skip_t = ann_last_t = -1;
+	    ann_skip_k = ann_last_k = 0;
+	    ann_left = (alimit > 0) ? alimit : -1;
+	    ann_more = 0;
+	    if (cursor_t[i] >= ta0) {
+		ts = ann_skip_t = cursor_t[i];
+		ann_skip_k = cursor_k[i];
+	    }
+	    if (ts > 0L) {
+		if (x) annidx_seek(x, ts);
+		else iannsettime(ts);
+	    }
 	    if (!afirst) printf(",");
 	    else afirst = 0;
 	    printf("\n      { \"name\": \"%s\",\n", annotator[i]);
-	    printf("        \"annotation\":\n");
-	    printf("        [");
-	    while ((getann(0, &annot) == 0) && (taf <= 0 || annot.time < taf)) {
-		if (!first) printf(",");
-		else first = 0;
-		if (annot.anntyp > 0 && annot.anntyp <= ACMAX)
-		    used[annot.anntyp] = 1;
-		printf("\n          { \"t\": %ld,\n", (long)(annot.time));
-		printf("            \"a\": %s,\n",
-		       p = strjson(annstr(annot.anntyp)));
-		SFREE(p);
-		printf("            \"s\": %d,\n", annot.subtyp);
-		printf("            \"c\": %d,\n", annot.chan);
-		printf("            \"n\": %d,\n", annot.num);
-		if (annot.aux && *(annot.aux)) {
-		    printf("            \"x\": %s\n", p = strjson(annot.aux+1));
-		    SFREE(p);
-		}
-		else
-		    printf("            \"x\": null\n");
-		printf("          }");
-	    }
-	    printf("\n        ],\n        \"description\":\n        {");
+	    if (columns) print_columns(x, taf, used);
+	    else print_objects(x, taf, used);
+	    annidx_close(x);
+	    if (ann_more)
+		printf("        \"next\": \"%ld.%ld\",\n",
+		       (long)ann_skip_t, ann_skip_k);
+	    printf("        \"description\":\n        {");
 
 	    /* Do not show descriptions for ambiguous mnemonics. */
 	    for (j = 1; j < ACMAX; j++) {
@@ -679,44 +1596,532 @@ int fetchannotations(void)
 		}
 	    }
 	    printf("\n        }\n      }");
+	    response_flush();
 	}
     }
     printf("\n    ]\n  }\n");
     return (1);
 }
 
-int fetchsignals(void)
+/* Return the index of the named annotator of the current record (which
+   must have just been opened as input annotator 0), making it first if
+   necessary, or NULL if it has no index (see annidx.c). */
+ANNIDX *open_annidx(char *name)
 {
-    int first = 1, framelen, i, imax, imin, j, *m, *mp, n;
-    WFDB_Calinfo cal;
-    WFDB_Sample **sb, **sp, *sbo, *spo, *v;
-    WFDB_Time t, ts0, tsf;
-
-    /* Do nothing if no samples were requested. */ 
-    if (nosig < 1 || t0 >= tf) return (0);
+    ANNIDX *x = NULL;
+    WFDB_Anninfo ai;
+    char *path = NULL;
+
+    if (!caching) return (NULL);
+    SSTRCPY(path, wfdbfile(name, recpath));
+    if (path && (x = annidx_open(recpath, name, path)) == NULL) {
+	/* Making the index reads the annotator to the end, so if it can't
+	   be used after all, reopen the annotator. */
+	if (annidx_build(recpath, name, path, 0) != 0 ||
+	    (x = annidx_open(recpath, name, path)) == NULL) {
+	    ai.name = name;
+	    ai.stat = WFDB_READ;
+	    (void)annopen(recpath, &ai, 1);
+	}
+    }
+    SFREE(path);
+    return (x);
+}
 
-    /* Open the signal calibration database. */
-    (void)calopen(NULL);
+/* Read the next annotation of input annotator 0 (from its index, if it
+   has one), unless it is at or after taf (if taf is positive).  The first
+   ann_skip_k annotations at time ann_skip_t (those returned in earlier
+   parts of a paged response) are skipped.  Once ann_left annotations have
+   been read (if ann_left isn't negative), ann_more is set, and the cursor
+   for the next part (the time of the next annotation, and the number of
+   annotations at that time to skip) is left in ann_skip_t and ann_skip_k.
+   Returns 0 if successful, or -1 if there are no more annotations. */
+int next_annotation(ANNIDX *x, WFDB_Annotation *annot, WFDB_Time taf)
+{
+    static unsigned long nread;
+
+    do {
+	if ((x ? annidx_get(x, annot) : getann(0, annot)) != 0 ||
+	    (taf > 0 && annot->time >= taf))
+	    return (-1);
+	if (annot->time == ann_last_t)
+	    ann_last_k++;
+	else {
+	    ann_last_t = annot->time;
+	    ann_last_k = 1;
+	}
+    } while (annot->time == ann_skip_t && ann_last_k <= ann_skip_k);
 
-    if (tfreq != ffreq) {
-	ts0 = (WFDB_Time)(t0*tfreq/ffreq + 0.5);
-	tsf = (WFDB_Time)(tf*tfreq/ffreq + 0.5);
-    }
-    else {
-	ts0 = t0;
-	tsf = tf;
+    if (ann_left == 0) {
+	ann_more = 1;
+	ann_skip_t = annot->time;
+	ann_skip_k = ann_last_k - 1;
+	return (-1);
     }
+    if (ann_left > 0) ann_left--;
+    if ((++nread & 255) == 0) response_flush();
+    return (0);
+}
 
-    /* Allocate buffers and buffer pointers for each selected signal. */
-    SUALLOC(sb, nsig, sizeof(WFDB_Sample *));
-    SUALLOC(sp, nsig, sizeof(WFDB_Sample *));
-    for (n = framelen = 0; n < nsig; framelen += s[n++].spf)
-	if (sigmap[n] >= 0) {
+/* Print the annotations of input annotator 0 (up to time taf, if taf is
+   positive) as an array of objects, and mark the annotation types that
+   appear in the used array. */
+void print_objects(ANNIDX *x, WFDB_Time taf, unsigned char *used)
+{
+    char *p;
+    int first = 1;
+    WFDB_Annotation annot;
+
+    printf("        \"annotation\":\n");
+    printf("        [");
+    while (next_annotation(x, &annot, taf) == 0) {
+	if (!first) printf(",");
+	else first = 0;
+	if (annot.anntyp > 0 && annot.anntyp <= ACMAX)
+	    used[(unsigned char)annot.anntyp] = 1;
+	printf("\n          { \"t\": %ld,\n", (long)(annot.time));
+	printf("            \"a\": %s,\n", p = strjson(annstr(annot.anntyp)));
+	SFREE(p);
+	printf("            \"s\": %d,\n", annot.subtyp);
+	printf("            \"c\": %d,\n", annot.chan);
+	printf("            \"n\": %d,\n", annot.num);
+	if (annot.aux && *(annot.aux)) {
+	    printf("            \"x\": %s\n",
+		   p = strjson((char *)annot.aux+1));
+	    SFREE(p);
+	}
+	else
+	    printf("            \"x\": null\n");
+	printf("          }");
+    }
+    printf("\n        ],\n");
+}
+
+/* Print the annotations of input annotator 0 (up to time taf, if taf is
+   positive) as parallel arrays, rather than as an array of objects as in
+   print_objects().  This is much more compact for long annotation
+   files, in which most annotations are of a few types and have no subtype,
+   chan, num, or aux values:
+      "t"         annotation times (the first is the time of the first
+                  annotation, and each of the others is the interval since
+                  the previous one)
+      "mnemonic"  the distinct annotation mnemonics
+      "a"         indices into "mnemonic"
+      "s", "c", "n", "x"
+                  the non-zero subtype, chan, and num values and non-null
+                  aux strings, each as an object whose "i" and "v" members
+                  are the indices of the annotations and their values
+   The used array is updated as in print_objects(). */
+void print_columns(ANNIDX *x, WFDB_Time taf, unsigned char *used)
+{
+    static char *sparse[] = { "s", "c", "n" };
+    char **aux = NULL, *p;
+    int code[256], nmnem = 0, k;
+    long i, j, len = 0, nalloc = 0, *t = NULL, *a = NULL, *v[3], *si, *sv;
+    WFDB_Annotation annot;
+    WFDB_Time prev = 0;
+
+    v[0] = v[1] = v[2] = NULL;
+    for (k = 0; k < 256; k++)
+	code[k] = -1;
+    while (next_annotation(x, &annot, taf) == 0) {
+	if (len >= nalloc) {
+	    nalloc = nalloc ? 2*nalloc : 1024;
+	    SREALLOC(t, nalloc, sizeof(long));
+	    SREALLOC(a, nalloc, sizeof(long));
+	    for (k = 0; k < 3; k++)
+		SREALLOC(v[k], nalloc, sizeof(long));
+	    SREALLOC(aux, nalloc, sizeof(char *));
+	}
+	k = (unsigned char)annot.anntyp;
+	if (k > 0 && k <= ACMAX)
+	    used[k] = 1;
+	if (code[k] < 0)
+	    code[k] = nmnem++;
+	t[len] = annot.time - prev;
+	prev = annot.time;
+	a[len] = code[k];
+	v[0][len] = annot.subtyp;
+	v[1][len] = annot.chan;
+	v[2][len] = annot.num;
+	aux[len] = NULL;
+	if (annot.aux && *(annot.aux))
+	    SSTRCPY(aux[len], (char *)annot.aux+1);
+	len++;
+    }
+
+    printf("        \"columns\":\n");
+    printf("        { \"t\": ");
+    print_longs(t, len);
+    printf(",\n          \"mnemonic\": [");
+    for (j = 0; j < nmnem; j++) {
+	for (k = 0; code[k] != j; k++)
+	    ;
+	printf("%s%s", j ? ", " : " ", p = strjson(annstr(k)));
+	SFREE(p);
+    }
+    printf(" ],\n          \"a\": ");
+    print_longs(a, len);
+
+    /* The sparse columns are made by moving the non-zero values to the
+       beginning of each array, and their indices to the beginning of t. */
+    si = t;
+    for (k = 0; k < 3; k++) {
+	sv = v[k];
+	for (i = j = 0; i < len; i++)
+	    if (sv[i]) {
+		si[j] = i;
+		sv[j++] = sv[i];
+	    }
+	printf(",\n          \"%s\": { \"i\": ", sparse[k]);
+	print_longs(si, j);
+	printf(", \"v\": ");
+	print_longs(sv, j);
+	printf(" }");
+    }
+    for (i = j = 0; i < len; i++)
+	if (aux[i]) si[j++] = i;
+    printf(",\n          \"x\": { \"i\": ");
+    print_longs(si, j);
+    printf(", \"v\": [");
+    for (i = j = 0; i < len; i++)
+	if (aux[i]) {
+	    printf("%s%s", j++ ? ", " : " ", p = strjson(aux[i]));
+	    SFREE(p);
+	    SFREE(aux[i]);
+	}
+    printf(" ] }\n        },\n");
+
+    SFREE(t);
+    SFREE(a);
+    for (k = 0; k < 3; k++)
+	SFREE(v[k]);
+    SFREE(aux);
+}
+
+/* Print the properties of signal n that precede the samples in the output
+   of fetchsignals() and fetchenvelopes(). */
+void print_sigheader(int n, WFDB_Time ts0, WFDB_Time tsf)
+{
+    char *p;
+
+    printf("      { \"name\": %s,\n", p = strjson(sname[n])); SFREE(p);
+    if (s[n].units) {
+	printf("        \"units\": %s,\n", p = strjson(s[n].units));
+	SFREE(p);
+    }
+    else
+	printf("        \"units\": \"mV\",\n");
+    printf("        \"t0\": %ld,\n", (long)ts0);
+    printf("        \"tf\": %ld,\n", (long)tsf);
+    printf("        \"gain\": %g,\n",
+	   s[n].gain ? s[n].gain : WFDB_DEFGAIN);
+    printf("        \"base\": %d,\n", s[n].baseline);
+    printf("        \"tps\": %d,\n", (int)(tfreq/(ffreq*s[n].spf)+0.5));
+    printf("        \"scale\": %g,\n", sigscale(n));
+}
+
+/* Return the scale factor for signal n from the calibration database (as
+   looked up by read_meta). */
+double sigscale(int n)
+{
+    return (meta->scale[n]);
+}
+
+/* Decimal digit pairs "00" through "99", used by print_deltas(). */
+static const char digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+
+/* Write the decimal representation of x ending just before p, and return
+   a pointer to its first character.  This produces the same output as
+   printf("%d"), two digits at a time. */
+static char *format_int(char *p, int x)
+{
+    unsigned int u = (x < 0) ? 0U - (unsigned int)x : (unsigned int)x, i;
+
+    while (u >= 100) {
+	i = (u % 100) * 2;
+	u /= 100;
+	*--p = digit_pairs[i+1];
+	*--p = digit_pairs[i];
+    }
+    if (u >= 10) {
+	*--p = digit_pairs[u*2+1];
+	*--p = digit_pairs[u*2];
+    }
+    else
+	*--p = '0' + u;
+    if (x < 0) *--p = '-';
+    return (p);
+}
+
+/* Print an array of samples as first differences, in the form
+   "[ d0,d1,...,dn ]".  This is the inner loop of fetchsignals() and
+   fetchenvelopes(), so rather than calling printf() for each sample, it
+   converts the samples in bulk into a local buffer and writes the
+   buffer when it is nearly full. */
+void print_deltas(WFDB_Sample *x, long n)
+{
+    WFDB_Sample prev = 0;
+
+    fwrite("[ ", 1, 2, stdout);
+    print_delta_part(x, n, &prev, 1);
+    fwrite(n > 0 ? " ]" : "]", 1, n > 0 ? 2 : 1, stdout);
+}
+
+/* Print the next n elements of an array that is printed in parts (by
+   fetchsignals_streamed), in the same form as print_deltas().  *prev is
+   the last element printed (or 0), and first is true if no element has
+   been printed yet. */
+void print_delta_part(WFDB_Sample *x, long n, WFDB_Sample *prev, int first)
+{
+    char out[BUFSIZE*8], num[12], *p = out, *q;
+    char *end = out + sizeof(out) - sizeof(num) - 1;
+    WFDB_Sample pv = *prev;
+    long i;
+
+    for (i = 0; i < n; i++) {
+	if (i > 0 || !first) *p++ = ',';
+	q = format_int(num + sizeof(num), x[i] - pv);
+	pv = x[i];
+	memcpy(p, q, num + sizeof(num) - q);
+	p += num + sizeof(num) - q;
+	if (p >= end) {
+	    fwrite(out, 1, p - out, stdout);
+	    p = out;
+	}
+    }
+    fwrite(out, 1, p - out, stdout);
+    *prev = pv;
+}
+
+/* Print an array of integers in the same form as print_deltas(), but
+   without differencing. */
+void print_longs(long *x, long n)
+{
+    char out[BUFSIZE*8], num[24], *p = out, *q;
+    char *end = out + sizeof(out) - sizeof(num) - 1;
+    long i;
+    int len;
+
+    *p++ = '[';
+    *p++ = ' ';
+    for (i = 0; i < n; i++) {
+	if (x[i] >= INT_MIN && x[i] <= INT_MAX)
+	    q = format_int(num + sizeof(num), (int)x[i]);
+	else {
+	    len = sprintf(num, "%ld", x[i]);
+	    q = memmove(num + sizeof(num) - len, num, len);
+	}
+	memcpy(p, q, num + sizeof(num) - q);
+	p += num + sizeof(num) - q;
+	*p++ = (i < n-1) ? ',' : ' ';
+	if (p >= end) {
+	    fwrite(out, 1, p - out, stdout);
+	    p = out;
+	}
+    }
+    *p++ = ']';
+    fwrite(out, 1, p - out, stdout);
+}
+
+/* Print the envelopes (nb buckets of tpb ticks each) of signal n. */
+void print_envelope(int n, WFDB_Time ts0, WFDB_Time tsf, long tpb,
+		    WFDB_Sample *min, WFDB_Sample *max, WFDB_Sample *mean,
+		    long nb)
+{
+    if (binfmt) {
+	WFDB_Sample *x[3];
+
+	x[0] = min; x[1] = max; x[2] = mean;
+	bin_signal(n, ts0, tsf, tpb, x, mean ? 3 : 2, nb);
+	return;
+    }
+    print_sigheader(n, ts0, tsf);
+    printf("        \"tpb\": %ld,\n", tpb);
+    printf("        \"min\": ");
+    print_deltas(min, nb);
+    printf(",\n        \"max\": ");
+    print_deltas(max, nb);
+    if (mean) {
+	printf(",\n        \"mean\": ");
+	print_deltas(mean, nb);
+    }
+    printf("\n      }");
+}
+
+/* Write the n low-order bytes of x, least significant byte first. */
+static void put_le(unsigned long long x, int n)
+{
+    unsigned char b[8];
+    int i;
+
+    for (i = 0; i < n; i++, x >>= 8)
+	b[i] = x & 0xff;
+    fwrite(b, 1, n, stdout);
+}
+
+/* Return the bit pattern of an IEEE double. */
+static unsigned long long double_bits(double x)
+{
+    unsigned long long u;
+
+    memcpy(&u, &x, sizeof(u));
+    return (u);
+}
+
+/* Write zero bytes to align the output on a 4-byte boundary, given that
+   len bytes have been written since the last boundary. */
+static void put_pad(long len)
+{
+    static const unsigned char zero[4];
+
+    if (len % 4) fwrite(zero, 1, 4 - len % 4, stdout);
+}
+
+/* A binary response to a fetch request begins with the magic string "LWB1"
+   and the number of signal blocks that follow (as a 32-bit unsigned
+   integer).  All integers are little-endian. */
+void bin_begin(int nout)
+{
+    fwrite("LWB1", 1, 4, stdout);
+    put_le(nout, 4);
+}
+
+/* bin_signal() writes the block for signal n in a binary response.  Each
+   block has a 60-byte fixed header:
+	offset	size	contents
+	0	8	t0 (signed)
+	8	8	tf (signed)
+	16	8	gain (IEEE double)
+	24	8	scale (IEEE double)
+	32	4	base (signed)
+	36	4	tps (ticks per sample)
+	40	4	tpb (ticks per bucket; 0 if x contains samples)
+	44	4	count (number of samples or buckets)
+	48	4	number of bytes of sample data
+	52	1	encoding (BIN_INT16, BIN_INT32 or BIN_VARINT)
+	53	1	narr (1 for samples; 2 or 3 for min, max, and mean)
+	54	2	length of the signal name
+	56	2	length of the units string
+	58	2	reserved (0)
+   followed by the name and units (not null-terminated), padding to a
+   4-byte boundary, the sample data, and more padding.  The sample data
+   consist of narr arrays of count values each.  In BIN_VARINT encoding,
+   each array is sent as first differences (as in the JSON response), each
+   mapped to an unsigned integer by "zigzag" encoding (0, -1, 1, -2, ... ->
+   0, 1, 2, 3, ...) and written 7 bits at a time, low-order bits first,
+   with the high bit of each byte set if more bytes follow.  This is the
+   default, since it is usually the most compact.  If the client asks for
+   enc=raw, the values are sent as they are, as 16-bit integers if they
+   all fit, or as 32-bit integers otherwise; these can be used directly
+   as typed arrays on the client side, since they are suitably aligned. */
+void bin_signal(int n, WFDB_Time ts0, WFDB_Time tsf, long tpb,
+		WFDB_Sample **x, int narr, long count)
+{
+    char *units = s[n].units ? s[n].units : "mV";
+    int enc, i;
+    long j, namelen = strlen(sname[n]), unitslen = strlen(units), nbytes;
+    unsigned char *data, *p;
+    unsigned int z;
+
+    if (namelen > 65535) namelen = 65535;
+    if (unitslen > 65535) unitslen = 65535;
+    enc = binraw ? BIN_INT16 : BIN_VARINT;
+    for (i = 0; i < narr && enc == BIN_INT16; i++)
+	for (j = 0; j < count; j++)
+	    if (x[i][j] < -32768 || x[i][j] > 32767) { enc = BIN_INT32; break; }
+
+    /* Encode the samples. */
+    SUALLOC(data, narr * count * 5 + 1, 1);
+    for (i = 0, p = data; i < narr; i++) {
+	unsigned int prev = 0;
+
+	for (j = 0; j < count; j++) {
+	    z = (unsigned int)x[i][j];
+	    if (enc == BIN_VARINT) {
+		unsigned int d = z - prev;
+
+		prev = z;
+		for (z = (d << 1) ^ (0U - (d >> 31)); z >= 0x80; z >>= 7)
+		    *p++ = (z & 0x7f) | 0x80;
+		*p++ = z;
+	    }
+	    else {
+		*p++ = z & 0xff;
+		*p++ = (z >> 8) & 0xff;
+		if (enc == BIN_INT32) {
+		    *p++ = (z >> 16) & 0xff;
+		    *p++ = (z >> 24) & 0xff;
+		}
+	    }
+	}
+    }
+    nbytes = p - data;
+
+    put_le((unsigned long long)ts0, 8);
+    put_le((unsigned long long)tsf, 8);
+    put_le(double_bits(s[n].gain ? s[n].gain : WFDB_DEFGAIN), 8);
+    put_le(double_bits(sigscale(n)), 8);
+    put_le((unsigned int)s[n].baseline, 4);
+    put_le((unsigned int)(tfreq/(ffreq*s[n].spf)+0.5), 4);
+    put_le(tpb, 4);
+    put_le(count, 4);
+    put_le(nbytes, 4);
+    put_le(enc, 1);
+    put_le(narr, 1);
+    put_le(namelen, 2);
+    put_le(unitslen, 2);
+    put_le(0, 2);
+    fwrite(sname[n], 1, namelen, stdout);
+    fwrite(units, 1, unitslen, stdout);
+    put_pad(namelen + unitslen);
+    fwrite(data, 1, nbytes, stdout);
+    put_pad(nbytes);
+    SFREE(data);
+}
+
+int fetchsignals(void)
+{
+    int first = 1, framelen, i, imax, imin, j, *m, *mp, n;
+    long k, nf;
+    WFDB_Sample **sb, **sp, *v, *vp;
+    WFDB_Time t, ts0, tsf;
+
+    /* Do nothing if no samples were requested. */ 
+    if (nosig < 1 || t0 >= tf) return (0);
+
+    /* If the client has asked for no more than npts points per signal,
+       and there are more samples than that in the window, send the
+       envelopes of the signals instead. */
+    if (use_envelopes(tf - t0))
+	return (fetchenvelopes());
+    if (streaming && !binfmt)
+	return (fetchsignals_streamed());
+
+    if (tfreq != ffreq) {
+	ts0 = (WFDB_Time)(t0*tfreq/ffreq + 0.5);
+	tsf = (WFDB_Time)(tf*tfreq/ffreq + 0.5);
+    }
+    else {
+	ts0 = t0;
+	tsf = tf;
+    }
+
+    /* Allocate buffers and buffer pointers for each selected signal. */
+    SUALLOC(sb, nsig, sizeof(WFDB_Sample *));
+    SUALLOC(sp, nsig, sizeof(WFDB_Sample *));
+    for (n = framelen = 0; n < nsig; framelen += s[n++].spf)
+	if (sigmap[n] >= 0) {
 	    SUALLOC(sb[n], (int)((tf-t0)*s[n].spf + 0.5), sizeof(WFDB_Sample));
 	    sp[n] = sb[n];
 	}
-    /* Allocate a frame buffer and construct the frame map. */
-    SUALLOC(v, framelen, sizeof(WFDB_Sample));  /* frame buffer */
+    /* Allocate a buffer for a block of frames and construct the frame
+       map. */
+    SUALLOC(v, ENVBLOCK * framelen, sizeof(WFDB_Sample));
     SUALLOC(m, framelen, sizeof(int));	    /* frame map */
     for (i = n = 0; n < nsig; n++) {
 	for (j = 0; j < s[n].spf; j++)
@@ -727,48 +2132,36 @@ int fetchsignals(void)
     for (imin = 0; imin < imax && m[imin] < 0; imin++)
 	;
 
-    /* Fill the buffers. */
-    isigsettime(t0);
-    for (t = t0; t < tf && getframe(v) > 0; t++)
-	for (i = imin, mp = m + imin; i <= imax; i++, mp++)
-	    if ((n = *mp) >= 0) *(sp[n]++) = v[i];
+    /* Fill the buffers, reading the frames in blocks of ENVBLOCK. */
+    for (t = t0; t < tf; t += nf) {
+	nf = read_frames(v, t, (tf - t < ENVBLOCK) ? (long)(tf - t) : ENVBLOCK);
+	for (k = 0, vp = v; k < nf; k++, vp += framelen)
+	    for (i = imin, mp = m + imin; i <= imax; i++, mp++)
+		if ((n = *mp) >= 0) *(sp[n]++) = vp[i];
+	if (nf < ENVBLOCK) break;	/* end of record */
+    }
 
     /* Generate output. */
-    printf("  { \"signal\":\n    [\n");  
+    if (binfmt) bin_begin(nosig);
+    else printf("  { \"signal\":\n    [\n");  
     for (n = 0; n < nsig; n++) {
 	if (sigmap[n] >= 0) {
-	    char *p;
-	    int delta, prev; 
-
+	    if (binfmt) {
+		bin_signal(n, ts0, tsf, 0L, &sb[n], 1, (long)(sp[n] - sb[n]));
+		continue;
+	    }
  	    if (!first) printf(",\n");
 	    else first = 0;
-	    printf("      { \"name\": %s,\n", p = strjson(sname[n])); SFREE(p);
-	    if (s[n].units) {
-		printf("        \"units\": %s,\n", p = strjson(s[n].units));
-		SFREE(p);
-	    }
-	    else
-		printf("        \"units\": \"mV\",\n");
-	    printf("        \"t0\": %ld,\n", (long)ts0);
-	    printf("        \"tf\": %ld,\n", (long)tsf);
-	    printf("        \"gain\": %g,\n",
-		   s[n].gain ? s[n].gain : WFDB_DEFGAIN);
-	    printf("        \"base\": %d,\n", s[n].baseline);
-	    printf("        \"tps\": %d,\n", (int)(tfreq/(ffreq*s[n].spf)+0.5));
-	    if (getcal(sname[n], s[n].units, &cal) == 0)
-		printf("        \"scale\": %g,\n", cal.scale);
-	    else
-		printf("        \"scale\": 1,\n");
-	    printf("        \"samp\": [ ");
-	    for (sbo = sb[n], prev = 0, spo = sp[n]-1; sbo < spo; sbo++) {
-		delta = *sbo - prev;
-		printf("%d,", delta);
-		prev = *sbo;
-	    }
-	    printf("%d ]\n      }", *sbo - prev);
+	    print_sigheader(n, ts0, tsf);
+	    printf("        \"samp\": ");
+	    /* If no samples could be read, sb[n][0] (which is zero) is sent,
+	       as in earlier versions. */
+	    print_deltas(sb[n], sp[n] > sb[n] ? (long)(sp[n] - sb[n]) : 1L);
+	    printf("\n      }");
+	    response_flush();
 	}
     }
-    printf("\n    ]%s", nann ? ",\n" : "\n  }\n");
+    if (!binfmt) printf("\n    ]%s", nann ? ",\n" : "\n  }\n");
     flushcal();
     for (n = 0; n < nsig; n++)
 	SFREE(sb[n]);
@@ -779,17 +2172,1013 @@ int fetchsignals(void)
     return (1);	/* output was written */
 }
 
+/* fetchsignals_streamed() writes the same output as fetchsignals(), but
+   using an amount of memory that doesn't depend on the length of the
+   window, so that a streamed response can cover a much longer window.
+   Rather than collecting all of the samples of each signal before
+   printing any of them, it reads the frames in blocks of ENVBLOCK, once
+   for each selected signal, and prints (and sends, see response.c) the
+   samples of that signal in each block before reading the next. */
+int fetchsignals_streamed(void)
+{
+    int first = 1, framelen, i, j, n, off;
+    long k, nf, ns;
+    WFDB_Sample *blk, prev, *v, *vp;
+    WFDB_Time t, ts0, tsf;
+
+    if (tfreq != ffreq) {
+	ts0 = (WFDB_Time)(t0*tfreq/ffreq + 0.5);
+	tsf = (WFDB_Time)(tf*tfreq/ffreq + 0.5);
+    }
+    else {
+	ts0 = t0;
+	tsf = tf;
+    }
+    for (n = framelen = 0; n < nsig; n++)
+	framelen += s[n].spf;
+    SUALLOC(v, ENVBLOCK * framelen, sizeof(WFDB_Sample));
+    SUALLOC(blk, ENVBLOCK * framelen, sizeof(WFDB_Sample));
+
+    printf("  { \"signal\":\n    [\n");
+    for (n = off = 0; n < nsig; off += s[n++].spf) {
+	if (sigmap[n] < 0) continue;
+	if (!first) printf(",\n");
+	first = 0;
+	print_sigheader(n, ts0, tsf);
+	printf("        \"samp\": [ ");
+	prev = 0;
+	for (t = t0, ns = 0; t < tf; t += nf) {
+	    nf = read_frames(v, t, (tf - t < ENVBLOCK) ? (long)(tf - t) : ENVBLOCK);
+	    for (k = i = 0, vp = v + off; k < nf; k++, vp += framelen)
+		for (j = 0; j < s[n].spf; j++)
+		    blk[i++] = vp[j];
+	    print_delta_part(blk, i, &prev, ns == 0);
+	    ns += i;
+	    response_flush();
+	    if (nf < ENVBLOCK) break;	/* end of record */
+	}
+	/* As in fetchsignals, a zero is sent if no samples could be read. */
+	printf("%s]\n      }", ns > 0 ? " " : "0 ");
+	response_flush();
+    }
+    printf("\n    ]%s", nann ? ",\n" : "\n  }\n");
+    flushcal();
+    SFREE(v);
+    SFREE(blk);
+    return (1);	/* output was written */
+}
+
+/* The structure below holds the state of the envelope computation for one
+   signal in fetchenvelopes().  Each bucket contains spb consecutive samples
+   (except possibly the last one, which may be shorter). */
+struct envelope {
+    long spb;		/* samples per bucket */
+    long nb;		/* number of buckets */
+    long b;		/* index of the current bucket */
+    long c;		/* number of samples added to the current bucket */
+    long nv;		/* number of valid samples in the current bucket */
+    long long sum;	/* sum of valid samples in the current bucket */
+    WFDB_Sample lo, hi;	/* extrema of valid samples in the current bucket */
+    WFDB_Sample *min, *max, *mean;	/* results, nb elements each */
+    WFDB_Sample *blk;	/* samples from the current block of frames */
+    long nblk;		/* number of samples in blk */
+};
+
+/* Find the extrema and sum of the valid samples in x[0 ... n-1], and return
+   the number of valid samples.  This is the inner loop of fetchenvelopes(),
+   written without early exits or data-dependent branches so that the
+   compiler can vectorize it. */
+static long minmax(const WFDB_Sample *x, long n, WFDB_Sample *lo,
+		   WFDB_Sample *hi, long long *sum)
+{
+    WFDB_Sample a = *lo, b = *hi, y;
+    long i, nv = 0;
+    long long sx = 0;
+    int ok;
+
+    for (i = 0; i < n; i++) {
+	y = x[i];
+	ok = (y != WFDB_INVALID_SAMPLE);
+	a = (ok && y < a) ? y : a;
+	b = (ok && y > b) ? y : b;
+	sx += ok ? y : 0;
+	nv += ok;
+    }
+    *lo = a;
+    *hi = b;
+    *sum += sx;
+    return (nv);
+}
+
+/* Record the results for the current bucket, and start the next one. */
+static void envelope_close(struct envelope *e)
+{
+    if (e->nv > 0) {
+	e->min[e->b] = e->lo;
+	e->max[e->b] = e->hi;
+	if (e->mean)
+	    e->mean[e->b] = (WFDB_Sample)floor((double)e->sum/e->nv + 0.5);
+    }
+    else {	/* no valid samples in this bucket */
+	e->min[e->b] = e->max[e->b] = WFDB_INVALID_SAMPLE;
+	if (e->mean) e->mean[e->b] = WFDB_INVALID_SAMPLE;
+    }
+    e->b++;
+    e->c = e->nv = 0;
+    e->sum = 0;
+    e->lo = WFDB_SAMPLE_MAX;
+    e->hi = WFDB_SAMPLE_MIN;
+}
+
+/* Add n consecutive samples to the envelope. */
+static void envelope_add(struct envelope *e, const WFDB_Sample *x, long n)
+{
+    long k;
+
+    while (n > 0 && e->b < e->nb) {
+	if ((k = e->spb - e->c) > n) k = n;
+	e->nv += minmax(x, k, &e->lo, &e->hi, &e->sum);
+	e->c += k;
+	x += k;
+	n -= k;
+	if (e->c == e->spb) envelope_close(e);
+    }
+}
+
+int fetchenvelopes(void)
+{
+    int first = 1, framelen, i, j, level, n, *m;
+    long nf, ns;
+    struct envelope *env, *e;
+    WFDB_Sample *v, *vp;
+    WFDB_Time t, ts0, tsf;
+
+    if (pyr && (level = pyr_level(pyr, (long)(tf - t0), npts)) >= 0)
+	return (fetchpyramid(level));
+
+    if (tfreq != ffreq) {
+	ts0 = (WFDB_Time)(t0*tfreq/ffreq + 0.5);
+	tsf = (WFDB_Time)(tf*tfreq/ffreq + 0.5);
+    }
+    else {
+	ts0 = t0;
+	tsf = tf;
+    }
+
+    /* Choose the bucket size for each selected signal, so that there are
+       no more than npts buckets, and allocate buffers. */
+    SUALLOC(env, nsig, sizeof(struct envelope));
+    for (n = framelen = 0; n < nsig; framelen += s[n++].spf)
+	if (sigmap[n] >= 0) {
+	    e = &env[n];
+	    ns = (long)((tf-t0)*s[n].spf);
+	    e->spb = (ns + npts - 1) / npts;
+	    if (e->spb < 1) e->spb = 1;
+	    e->nb = (ns + e->spb - 1) / e->spb;
+	    SUALLOC(e->min, e->nb + 1, sizeof(WFDB_Sample));
+	    SUALLOC(e->max, e->nb + 1, sizeof(WFDB_Sample));
+	    if (envmean)
+		SUALLOC(e->mean, e->nb + 1, sizeof(WFDB_Sample));
+	    SUALLOC(e->blk, ENVBLOCK * s[n].spf, sizeof(WFDB_Sample));
+	    e->lo = WFDB_SAMPLE_MAX;
+	    e->hi = WFDB_SAMPLE_MIN;
+	}
+
+    /* Allocate a buffer for a block of frames and construct the frame
+       map. */
+    SUALLOC(v, ENVBLOCK * framelen, sizeof(WFDB_Sample));
+    SUALLOC(m, framelen, sizeof(int));
+    for (i = n = 0; n < nsig; n++) {
+	for (j = 0; j < s[n].spf; j++)
+	    m[i++] = sigmap[n];
+    }
+
+    /* Read the frames in blocks of ENVBLOCK; copy the samples of each
+       selected signal into its block buffer, then reduce them. */
+    for (t = t0; t < tf; t += nf) {
+	nf = read_frames(v, t, (tf - t < ENVBLOCK) ? (long)(tf - t) : ENVBLOCK);
+	for (j = 0, vp = v; j < nf; j++, vp += framelen)
+	    for (i = 0; i < framelen; i++)
+		if ((n = m[i]) >= 0)
+		    env[n].blk[env[n].nblk++] = vp[i];
+	for (n = 0; n < nsig; n++)
+	    if (sigmap[n] >= 0) {
+		envelope_add(&env[n], env[n].blk, env[n].nblk);
+		env[n].nblk = 0;
+	    }
+	if (nf < ENVBLOCK) break;	/* end of record */
+    }
+
+    /* Generate output. */
+    if (binfmt) bin_begin(nosig);
+    else printf("  { \"signal\":\n    [\n");
+    for (n = 0; n < nsig; n++) {
+	if (sigmap[n] >= 0) {
+	    e = &env[n];
+	    if (e->c > 0) envelope_close(e);	/* last (partial) bucket */
+	    if (!first && !binfmt) printf(",\n");
+	    first = 0;
+	    print_envelope(n, ts0, tsf,
+			   e->spb * (long)(tfreq/(ffreq*s[n].spf)+0.5),
+			   e->min, e->max, e->mean, e->b);
+	    SFREE(e->min);
+	    SFREE(e->max);
+	    SFREE(e->mean);
+	    SFREE(e->blk);
+	}
+    }
+    if (!binfmt) printf("\n    ]%s", nann ? ",\n" : "\n  }\n");
+    flushcal();
+    SFREE(env);
+    SFREE(v);
+    SFREE(m);
+    return (1);	/* output was written */
+}
+
+/* fetchpyramid() produces the same output as fetchenvelopes(), using the
+   precomputed envelopes at the chosen level of the record's pyramid.  Since
+   the pyramid's buckets are aligned to the beginning of the record, the
+   first bucket may begin before t0, and the last may end after tf. */
+int fetchpyramid(int level)
+{
+    int first = 1, n;
+    long bf = pyr_bucket(pyr, level), b0, nb, k, tpb;
+    WFDB_Sample *min, *max, *mean = NULL;
+    WFDB_Time ts0;
+
+    b0 = t0 / bf;
+    nb = (tf - 1) / bf - b0 + 1;
+    if (nb > pyr_buckets(pyr, level) - b0)
+	nb = pyr_buckets(pyr, level) - b0;
+    if (nb < 1) nb = 1;	/* pyr_read reads nothing past the end */
+    tpb = (long)(bf*tfreq/ffreq + 0.5);	/* ticks per bucket */
+    ts0 = b0 * tpb;
+    SUALLOC(min, nb, sizeof(WFDB_Sample));
+    SUALLOC(max, nb, sizeof(WFDB_Sample));
+    if (envmean)
+	SUALLOC(mean, nb, sizeof(WFDB_Sample));
+
+    if (binfmt) bin_begin(nosig);
+    else printf("  { \"signal\":\n    [\n");
+    for (n = 0; n < nsig; n++) {
+	if (sigmap[n] >= 0) {
+	    k = pyr_read(pyr, level, n, b0, nb, min, max, mean);
+	    if (!first && !binfmt) printf(",\n");
+	    first = 0;
+	    print_envelope(n, ts0, ts0 + k*tpb, tpb, min, max, mean, k);
+	}
+    }
+    if (!binfmt) printf("\n    ]%s", nann ? ",\n" : "\n  }\n");
+    flushcal();
+    SFREE(min);
+    SFREE(max);
+    SFREE(mean);
+    return (1);	/* output was written */
+}
+
 void fetch(void)
 {
     prep_signals();
+    open_signals();
     if (nsig > 0) map_signals();
     prep_annotators();
+    prep_envelopes();
     prep_times();
+    note_sequential();
+    note_deps();
+    if (not_modified()) return;
+    if (binfmt) {	/* annotations are not included in binary responses */
+	if (fetchsignals() == 0) bin_begin(0);
+	return;
+    }
     printf("{ \"fetch\":\n");
     if ((fetchsignals() + fetchannotations()) == 0) printf("null");
     printf("}\n");
 }
 
+/* histogram() counts the annotations of each type in a series of bins, each
+"width" seconds long, from t0 to t0+dt (or, if dt is 0, to the last
+annotation), for each of the requested annotators.  If there would be more
+than HISTMAXBINS bins, the bins are widened as needed.  This lets the client
+draw an overview of a long record without reading all of its annotations. */
+void histogram(void)
+{
+    char *p;
+    double w;
+    int i, j, afirst = 1, first;
+    long *count[ACMAX+1], nb, maxb, b, k, v;
+    WFDB_Anninfo ai;
+    WFDB_Annotation annot;
+    WFDB_Time ta0, taf, width;
+    ANNIDX *x;
+
+    prep_signals();
+    open_signals();
+    prep_annotators();
+    if (nann < 1) {
+	lwfail("Your request did not specify an annotator");
+	return;
+    }
+    note_deps();
+    if (not_modified()) return;
+
+    /* Unlike a fetch, the interval isn't limited to 2 minutes, since the
+       size of the response depends only on the number of bins. */
+    if ((p = get_param("t0")) == NULL) p = "0";
+    if ((t0 = strtim(p)) < 0L) t0 = -t0;
+    ta0 = (WFDB_Time)(t0*tfreq/ffreq + 0.5);
+    if ((p = get_param("dt")) == NULL || (w = atof(p)) <= 0.) taf = 0;
+    else taf = ta0 + (WFDB_Time)(w*tfreq + 0.5);
+    if ((p = get_param("width")) == NULL || (w = atof(p)) <= 0.)
+	w = HISTWIDTH;
+    if ((width = (WFDB_Time)(w*tfreq + 0.5)) < 1) width = 1;
+    if (taf > 0 && (taf - ta0 + width - 1) / width > HISTMAXBINS)
+	width = (taf - ta0 + HISTMAXBINS - 1) / HISTMAXBINS;
+
+    printf("{ \"histogram\":\n");
+    printf("  { \"tfreq\": %.12g,\n", tfreq);
+    printf("    \"t0\": %ld,\n", (long)ta0);
+    printf("    \"annotator\":\n    [");
+    setgvmode(WFDB_HIGHRES);
+    for (i = 0; i < nann; i++) {
+	ai.name = annotator[i];
+	ai.stat = WFDB_READ;
+	if (annopen(recpath, &ai, 1) < 0)
+	    continue;
+	x = open_annidx(annotator[i]);
+	if (ta0 > 0L) {
+	    if (x) annidx_seek(x, ta0);
+	    else iannsettime(ta0);
+	}
+	ann_skip_t = ann_last_t = -1;
+	ann_left = -1;
+	memset(count, 0, sizeof(count));
+	nb = maxb = 0;
+	w = width;	/* each annotator's bins may be widened separately */
+	while (next_annotation(x, &annot, taf) == 0) {
+	    if (annot.anntyp < 0 || annot.anntyp > ACMAX || annot.time < ta0)
+		continue;
+	    while ((b = (annot.time - ta0) / (WFDB_Time)w) >= HISTMAXBINS) {
+		/* Too many bins: merge each pair of bins. */
+		for (j = 0; j <= ACMAX; j++)
+		    if (count[j])
+			for (k = 0; k < nb; k++) {
+			    v = count[j][k];
+			    count[j][k] = 0;
+			    count[j][k/2] += v;
+			}
+		nb = (nb + 1) / 2;
+		w *= 2;
+	    }
+	    if (b >= maxb) {
+		maxb = (b < HISTMAXBINS/2) ? 2*b + 1 : HISTMAXBINS;
+		for (j = 0; j <= ACMAX; j++)
+		    if (count[j]) {
+			SREALLOC(count[j], maxb, sizeof(long));
+			memset(count[j] + nb, 0, (maxb - nb) * sizeof(long));
+		    }
+	    }
+	    if (count[(unsigned char)annot.anntyp] == NULL)
+		SUALLOC(count[(unsigned char)annot.anntyp], maxb, sizeof(long));
+	    count[(unsigned char)annot.anntyp][b]++;
+	    if (b >= nb) nb = b + 1;
+	}
+	annidx_close(x);
+	if (taf > 0) nb = (taf - ta0 + (WFDB_Time)w - 1) / (WFDB_Time)w;
+
+	if (!afirst) printf(",");
+	else afirst = 0;
+	printf("\n      { \"name\": \"%s\",\n", annotator[i]);
+	printf("        \"width\": %ld,\n", (long)w);
+	printf("        \"mnemonic\": [");
+	for (j = 0, first = 1; j <= ACMAX; j++)
+	    if (count[j]) {
+		printf("%s%s", first ? " " : ", ", p = strjson(annstr(j)));
+		SFREE(p);
+		first = 0;
+	    }
+	printf(" ],\n        \"count\": [");
+	for (j = 0, first = 1; j <= ACMAX; j++)
+	    if (count[j]) {
+		if (nb > maxb) {	/* bins after the last annotation */
+		    SREALLOC(count[j], nb, sizeof(long));
+		    memset(count[j] + maxb, 0, (nb - maxb) * sizeof(long));
+		}
+		printf("%s", first ? "\n          " : ",\n          ");
+		print_longs(count[j], nb);
+		SFREE(count[j]);
+		first = 0;
+	    }
+	printf(" ]\n      }");
+	response_flush();
+    }
+    printf("\n    ]\n  },\n");
+    lwpass();
+}
+
+/* Criteria for search(): an annotation matches if it has all of the given
+attributes. */
+struct search_spec {
+    char *type;		/* mnemonic, or "*", "*v", "*s", "*n", or NULL */
+    char *aux;		/* fnmatch(3) pattern for the aux string, or NULL */
+    int subtyp, chan, num;	/* field values, or INT_MIN for any value */
+};
+
+/* Return true if an annotation matches a search.  The classes "*v", "*s",
+and "*n" (ventricular ectopic, supraventricular ectopic, and normal beats)
+are those used by the client's match(). */
+int search_match(struct search_spec *sp, WFDB_Annotation *a)
+{
+    char *m = annstr(a->anntyp), *set = NULL, aux[256];
+
+    if (sp->type == NULL || strcmp(sp->type, "*") == 0)
+	;
+    else if (strcmp(sp->type, "*v") == 0) set = "VEr";
+    else if (strcmp(sp->type, "*s") == 0) set = "SAaJejn";
+    else if (strcmp(sp->type, "*n") == 0) set = "NLRBF/fQ?";
+    else if (m == NULL || strcmp(m, sp->type) != 0)
+	return (0);
+    if (set && (m == NULL || m[0] == '\0' || m[1] || !strchr(set, m[0])))
+	return (0);
+
+    if ((sp->subtyp != INT_MIN && a->subtyp != sp->subtyp) ||
+	(sp->chan != INT_MIN && a->chan != sp->chan) ||
+	(sp->num != INT_MIN && a->num != sp->num))
+	return (0);
+    if (sp->aux) {
+	if (a->aux == NULL) return (0);
+	memcpy(aux, a->aux + 1, a->aux[0]);
+	aux[a->aux[0]] = '\0';
+	if (fnmatch(sp->aux, aux, 0) != 0) return (0);
+    }
+    return (1);
+}
+
+/* search() finds the times of the next n annotations (or, if dir is
+negative, the previous n annotations) of the first requested annotator that
+match the criteria given by the type, subtyp, chan, num, and aux parameters,
+starting at t0 (inclusive when searching forward, exclusive when searching
+backward).  This lets the client search a long record without reading all of
+its annotations. */
+void search(void)
+{
+    char *p;
+    int dir = 1;
+    long *match, *ring, found = 0, nmatch = 1, n, k, i;
+    struct search_spec spec;
+    WFDB_Anninfo ai;
+    WFDB_Annotation annot;
+    WFDB_Time t, ws, we, w;
+    ANNIDX *x;
+
+    prep_signals();
+    open_signals();
+    prep_annotators();
+    if (nann < 1) {
+	lwfail("Your request did not specify an annotator");
+	return;
+    }
+    note_deps();
+    if (not_modified()) return;
+
+    if ((p = get_param("t0")) == NULL) p = "0";
+    if ((t0 = strtim(p)) < 0L) t0 = -t0;
+    t = (WFDB_Time)(t0*tfreq/ffreq + 0.5);
+    if ((p = get_param("dir")) && atoi(p) < 0) dir = -1;
+    if ((p = get_param("n")) && (nmatch = atol(p)) < 1) nmatch = 1;
+    if (nmatch > SEARCHMAX) nmatch = SEARCHMAX;
+    spec.type = get_param("type");
+    spec.aux = get_param("aux");
+    spec.subtyp = (p = get_param("subtyp")) ? atoi(p) : INT_MIN;
+    spec.chan = (p = get_param("chan")) ? atoi(p) : INT_MIN;
+    spec.num = (p = get_param("num")) ? atoi(p) : INT_MIN;
+
+    setgvmode(WFDB_HIGHRES);
+    ai.name = annotator[0];
+    ai.stat = WFDB_READ;
+    if (annopen(recpath, &ai, 1) < 0) {
+	lwfail("The annotator could not be read");
+	return;
+    }
+    x = open_annidx(annotator[0]);
+    ann_skip_t = ann_last_t = -1;
+    ann_left = -1;
+    SUALLOC(match, nmatch, sizeof(long));
+
+    if (dir > 0) {
+	if (t > 0L) {
+	    if (x) annidx_seek(x, t);
+	    else iannsettime(t);
+	}
+	while (found < nmatch && next_annotation(x, &annot, 0) == 0)
+	    if (annot.time >= t && search_match(&spec, &annot))
+		match[found++] = annot.time;
+    }
+    else {
+	/* Read intervals of increasing length ending at t, each ending where
+	   the previous one began, until enough matches have been found,
+	   keeping the last few matches in each.  Without an index, the
+	   annotator can only be read from the beginning, so there is just one
+	   interval. */
+	SUALLOC(ring, nmatch, sizeof(long));
+	for (we = t, w = (WFDB_Time)(SEARCHWIN*tfreq) + 1;
+	     we > 0 && found < nmatch; we = ws, w *= 2) {
+	    ws = (x && we > w) ? we - w : 0;
+	    if (x) annidx_seek(x, ws);
+	    k = nmatch - found;
+	    n = 0;
+	    while (next_annotation(x, &annot, we) == 0)
+		if (annot.time >= ws && search_match(&spec, &annot))
+		    ring[n++ % k] = annot.time;
+	    for (i = 1; i <= n && i <= k; i++)
+		match[found++] = ring[(n - i) % k];
+	}
+	SFREE(ring);
+    }
+    annidx_close(x);
+
+    printf("{ \"search\":\n");
+    printf("  { \"annotator\": \"%s\",\n", annotator[0]);
+    printf("    \"tfreq\": %.12g,\n", tfreq);
+    printf("    \"t\": ");
+    print_longs(match, found);
+    printf("\n  },\n");
+    SFREE(match);
+    lwpass();
+}
+
+/* State of a signal scan by find().  Each event is a "run" of consecutive
+samples: for a level test, samples inside (or, if invert is true, outside)
+the range from lo to hi; for a flatness test, samples with a range of no
+more than tol, lasting at least minlen samples.  Invalid samples (as in
+minmax()) belong to no run, and end any run in progress. */
+struct finder {
+    int flat;			/* true for a flatness test */
+    int invert;			/* true if runs are outside [lo, hi] */
+    WFDB_Sample lo, hi, tol;
+    long minlen;
+    int in;			/* true if the last sample was in a run */
+    int reported;		/* true if the current run has been reported */
+    long start;			/* first sample of the current run */
+    WFDB_Sample rmin, rmax;	/* range of the current (flat) run */
+};
+
+/* Scan a block of n samples, x[0..n-1], the first of which is sample s0 of
+   the signal, for the beginnings of runs (see struct finder).  The sample
+   number of each beginning, if it is at least smin, is stored in hit[], up
+   to nmax of them.  Returns the number stored. */
+long find_runs(struct finder *f, WFDB_Sample *x, long n, long s0, long smin,
+	       long *hit, long nmax)
+{
+    WFDB_Sample min, max, v;
+    long i, nhit = 0;
+    int all_in, all_out, bad, p;
+
+    if (n < 1) return (0);
+
+    /* Most blocks don't contain the beginning of a run, and the extrema of
+       the block (found by a loop that the compiler can vectorize) are
+       usually enough to show that, unless the block has invalid samples. */
+    for (i = 1, min = max = x[0], bad = 0; i < n; i++) {
+	min = (x[i] < min) ? x[i] : min;
+	max = (x[i] > max) ? x[i] : max;
+    }
+    if (min == WFDB_INVALID_SAMPLE)
+	bad = 1;
+    else if (min < WFDB_INVALID_SAMPLE && max >= WFDB_INVALID_SAMPLE)
+	for (i = 0; i < n && !bad; i++)
+	    bad = (x[i] == WFDB_INVALID_SAMPLE);
+
+    if (f->flat) {
+	if (!bad && f->in && (max > f->rmax ? max : f->rmax) -
+	    (min < f->rmin ? min : f->rmin) <= f->tol) {
+	    if (min < f->rmin) f->rmin = min;
+	    if (max > f->rmax) f->rmax = max;
+	    if (!f->reported && s0 + n - f->start >= f->minlen) {
+		f->reported = 1;
+		if (f->start >= smin) hit[nhit++] = f->start;
+	    }
+	    return (nhit);
+	}
+	for (i = 0; i < n && nhit < nmax; i++) {
+	    if ((v = x[i]) == WFDB_INVALID_SAMPLE) {
+		f->in = 0;
+		continue;
+	    }
+	    if (!f->in || (v > f->rmax ? v : f->rmax) -
+		(v < f->rmin ? v : f->rmin) > f->tol) {
+		f->in = 1;
+		f->reported = 0;
+		f->start = s0 + i;
+		f->rmin = f->rmax = v;
+	    }
+	    else if (v < f->rmin) f->rmin = v;
+	    else if (v > f->rmax) f->rmax = v;
+	    if (!f->reported && s0 + i + 1 - f->start >= f->minlen) {
+		f->reported = 1;
+		if (f->start >= smin) hit[nhit++] = f->start;
+	    }
+	}
+	return (nhit);
+    }
+
+    all_in = (!bad && min >= f->lo && max <= f->hi);
+    all_out = (!bad && (max < f->lo || min > f->hi));
+    if (f->invert ? all_out : all_in) {
+	if (f->in) return (0);		/* the current run continues */
+    }
+    else if (f->invert ? all_in : all_out) {
+	f->in = 0;			/* no run in this block */
+	return (0);
+    }
+    for (i = 0; i < n && nhit < nmax; i++) {
+	p = (x[i] != WFDB_INVALID_SAMPLE &&
+	     (x[i] >= f->lo && x[i] <= f->hi) != f->invert);
+	if (p && !f->in && s0 + i >= smin)
+	    hit[nhit++] = s0 + i;
+	f->in = p;
+    }
+    return (nhit);
+}
+
+/* find() scans the first requested signal, starting at t0, for the first n
+events of the kind given by cond:
+    above	the signal rises above level
+    below	the signal falls below level
+    sat		the signal reaches the limits of its ADC range
+    flat	the signal varies by no more than tol for dt seconds or more
+(level and tol are in physical units).  At most FINDMAXDT seconds of the
+signal are read; the response includes the time at which to resume the scan
+if it didn't reach the end of the record.  Only the beginning of each event
+is reported, and (since the frame before t0 is read to establish whether an
+event is already in progress) events that began before t0 are not. */
+void find(void)
+{
+    char *cond, *p;
+    double gain, level = 0., w;
+    int eof = 0, framelen, i, j, off, sn;
+    long k, *hit, nhit = 0, nmax = 1, smin, spf;
+    struct finder f;
+    WFDB_Sample *v, *vp, *blk, amin, amax;
+    WFDB_Time t, tlim;
+
+    prep_signals();
+    open_signals();
+    if (nsig > 0) map_signals();
+    for (sn = 0; sn < nsig && sigmap[sn] < 0; sn++)
+	;
+    if (sn >= nsig) {
+	lwfail("Your request did not specify a signal");
+	return;
+    }
+    memset(&f, 0, sizeof(f));
+    gain = s[sn].gain ? s[sn].gain : WFDB_DEFGAIN;
+    if ((cond = get_param("cond")) == NULL)
+	cond = "";
+    if ((strcmp(cond, "above") == 0 || strcmp(cond, "below") == 0) &&
+	(p = get_param("level")))
+	level = atof(p) * gain + s[sn].baseline;
+    if (strcmp(cond, "above") == 0 && p) {
+	f.lo = (WFDB_Sample)floor(level) + 1;
+	f.hi = WFDB_SAMPLE_MAX;
+    }
+    else if (strcmp(cond, "below") == 0 && p) {
+	f.lo = WFDB_SAMPLE_MIN;
+	f.hi = (WFDB_Sample)ceil(level) - 1;
+    }
+    else if (strcmp(cond, "sat") == 0 && s[sn].adcres > 0) {
+	amin = s[sn].adczero - (1L << (s[sn].adcres - 1));
+	amax = s[sn].adczero + (1L << (s[sn].adcres - 1)) - 1;
+	f.lo = amin + 1;
+	f.hi = amax - 1;
+	f.invert = 1;
+    }
+    else if (strcmp(cond, "flat") == 0) {
+	f.flat = 1;
+	f.tol = (p = get_param("tol")) ? (WFDB_Sample)(atof(p) * gain) : 0;
+	w = (p = get_param("dt")) ? atof(p) : 1.;
+	if ((f.minlen = (long)(w * ffreq * s[sn].spf + 0.5)) < 1)
+	    f.minlen = 1;
+    }
+    else {
+	lwfail("Your request did not specify a valid condition");
+	return;
+    }
+    note_deps();
+    if (not_modified()) return;
+
+    if ((p = get_param("t0")) == NULL) p = "0";
+    if ((t0 = strtim(p)) < 0L) t0 = -t0;
+    if ((p = get_param("n")) && (nmax = atol(p)) < 1) nmax = 1;
+    if (nmax > SEARCHMAX) nmax = SEARCHMAX;
+
+    /* Read the frames in blocks of ENVBLOCK, copying the samples of the
+       chosen signal into a block buffer, and scan them. */
+    for (off = i = 0; i < sn; i++)
+	off += s[i].spf;
+    for (j = 0; i < nsig; i++)
+	j += s[i].spf;
+    spf = s[sn].spf;
+    framelen = off + j;
+    SUALLOC(v, ENVBLOCK * framelen, sizeof(WFDB_Sample));
+    SUALLOC(blk, ENVBLOCK * spf, sizeof(WFDB_Sample));
+    SUALLOC(hit, nmax, sizeof(long));
+    smin = t0 * spf;
+    tlim = t0 + (WFDB_Time)(FINDMAXDT * ffreq);
+    t = (t0 > 0L) ? t0 - 1 : 0L;
+    while (t < tlim && nhit < nmax && !eof) {
+	j = read_frames(v, t, (tlim - t < ENVBLOCK) ? (long)(tlim-t) : ENVBLOCK);
+	if (j < ENVBLOCK && t + j < tlim) eof = 1;
+	for (k = 0, vp = v + off; k < j * spf; vp += framelen)
+	    for (i = 0; i < spf; i++)
+		blk[k++] = vp[i];
+	t += j;
+	nhit += find_runs(&f, blk, k, (t - j) * spf, smin, hit + nhit,
+			  nmax - nhit);
+    }
+    if (nhit >= nmax)	/* resume after the frame of the last event */
+	t = hit[nhit-1] / spf + 1;
+
+    printf("{ \"find\":\n");
+    printf("  { \"signal\": %s,\n", p = strjson(sname[sn]));
+    SFREE(p);
+    printf("    \"tfreq\": %.12g,\n", tfreq);
+    for (k = 0; k < nhit; k++)	/* convert sample numbers to ticks */
+	hit[k] = (long)(hit[k] * tfreq / (ffreq * spf) + 0.5);
+    printf("    \"t\": ");
+    print_longs(hit, nhit);
+    if (eof && nhit < nmax)
+	printf(",\n    \"next\": null\n  },\n");
+    else
+	printf(",\n    \"next\": \"s%ld\"\n  },\n", (long)t);
+    SFREE(v);
+    SFREE(blk);
+    SFREE(hit);
+    lwpass();
+}
+
+/* batch() answers several fetch (or info) requests at once.  Each "item"
+parameter is a URL-encoded query string giving the record, signal(s),
+annotator(s), t0, dt, and any other parameters of one request (and its
+action and db, if they aren't "fetch" and the batch's db).  The responses
+are returned in an array, in the same order.  Consecutive items for the same
+record share the open record (see prep_signals).  Unless the server is
+sandboxed, the items are divided among several processes (one per CPU, up to
+BATCHJOBS); they are sorted by record first, so that each process opens each
+record at most once. */
+static char *batch_db;
+
+#ifndef SANDBOX
+/* An item of a batch request, and its record's name, for sorting. */
+struct batch_key {
+    char *record;
+    int i;
+};
+
+static int compare_items(const void *a, const void *b)
+{
+    const struct batch_key *x = a, *y = b;
+    int d = strcmp(x->record, y->record);
+
+    return (d ? d : x->i - y->i);
+}
+
+/* Write n bytes to a pipe. */
+static int write_all(int fd, const void *data, size_t n)
+{
+    const char *p = data;
+    ssize_t k;
+
+    while (n > 0) {
+	if ((k = write(fd, p, n)) < 0) {
+	    if (errno == EINTR) continue;
+	    return (-1);
+	}
+	p += k;
+	n -= k;
+    }
+    return (0);
+}
+
+/* Answer the n items of a batch request in njobs child processes, each of
+   which sends its responses to the parent through a pipe, and print the
+   responses in item order.  Any item that a child didn't answer (if it
+   couldn't be started, for example) is answered by the parent.  Returns 0
+   if successful, or -1 if no child could be started. */
+static int batch_parallel(char **item, int n, int njobs)
+{
+    char **buf, **out, *p, *q;
+    const char *body;
+    size_t *blen, *bsize, *outlen, k, len, mark;
+    int fd[BATCHJOBS], h[2], i, j, nopen, *order, started;
+    pid_t pid[BATCHJOBS];
+    struct pollfd pfd[BATCHJOBS];
+    struct batch_key *key;
+    ssize_t r;
+
+    /* Sort the items by record, and give each child a share of them. */
+    SUALLOC(key, n, sizeof(struct batch_key));
+    for (i = 0; i < n; i++) {
+	cgi_process_query(item[i]);
+	if ((p = get_param("db")) == NULL && (p = batch_db) == NULL) p = "";
+	if ((q = get_param("record")) == NULL) q = "";
+	SUALLOC(key[i].record, strlen(p) + strlen(q) + 2, sizeof(char));
+	sprintf(key[i].record, "%s/%s", p, q);
+	key[i].i = i;
+    }
+    qsort(key, n, sizeof(struct batch_key), compare_items);
+    SUALLOC(order, n, sizeof(int));
+    for (i = 0; i < n; i++) {
+	order[i] = key[i].i;
+	SFREE(key[i].record);
+    }
+    SFREE(key);
+
+    /* The children must not share the parent's open files (or their
+       offsets), so the parent closes the current record first. */
+    release_record();
+    fflush(stdout);
+    for (started = 0; started < njobs; started++) {
+	j = started;
+	if (pipe(h) != 0) break;
+	if ((pid[j] = fork()) < 0) {
+	    close(h[0]);
+	    close(h[1]);
+	    break;
+	}
+	if (pid[j] == 0) {
+	    close(h[0]);
+	    for (i = 0; i < j; i++)
+		close(fd[i]);
+	    blkcache_forked();	/* don't share the parent's connections */
+	    locate_forked();
+	    response_stream(0);
+	    for (k = (size_t)j*n/njobs; k < (size_t)(j+1)*n/njobs; k++) {
+		i = order[k];
+		mark = response_tell();
+		batch_item(item[i]);
+		if ((body = response_body(mark, &len)) == NULL)
+		    len = 0;
+		if (write_all(h[1], &i, sizeof(i)) ||
+		    write_all(h[1], &len, sizeof(len)) ||
+		    write_all(h[1], body, len))
+		    break;
+	    }
+	    _exit(0);
+	}
+	close(h[1]);
+	fd[j] = h[0];
+    }
+    SFREE(order);
+    if (started == 0) return (-1);
+
+    /* Read all of the pipes at once, so that no child is kept waiting. */
+    SUALLOC(buf, started, sizeof(char *));
+    SUALLOC(blen, started, sizeof(size_t));
+    SUALLOC(bsize, started, sizeof(size_t));
+    for (j = 0; j < started; j++) {
+	pfd[j].fd = fd[j];
+	pfd[j].events = POLLIN;
+    }
+    for (nopen = started; nopen > 0; ) {
+	if (poll(pfd, started, -1) < 0) {
+	    if (errno == EINTR) continue;
+	    break;
+	}
+	for (j = 0; j < started; j++) {
+	    if (pfd[j].fd < 0 || pfd[j].revents == 0) continue;
+	    if (blen[j] + BUFSIZE > bsize[j]) {
+		bsize[j] = 2*bsize[j] + BUFSIZE;
+		SREALLOC(buf[j], bsize[j], 1);
+	    }
+	    if ((r = read(fd[j], buf[j] + blen[j], bsize[j] - blen[j])) > 0)
+		blen[j] += r;
+	    else if (r < 0 && errno == EINTR)
+		continue;
+	    else {
+		close(fd[j]);
+		pfd[j].fd = -1;
+		nopen--;
+	    }
+	}
+    }
+
+    /* If poll failed, close the pipes that are still open, so that any
+       child still writing to one exits rather than waiting forever. */
+    for (j = 0; j < started; j++)
+	if (pfd[j].fd >= 0)
+	    close(pfd[j].fd);
+    for (j = 0; j < started; j++)
+	while (waitpid(pid[j], NULL, 0) < 0 && errno == EINTR)
+	    ;
+
+    /* Each response is preceded by its item number and its length. */
+    SUALLOC(out, n, sizeof(char *));
+    SUALLOC(outlen, n, sizeof(size_t));
+    for (j = 0; j < started; j++)
+	for (k = 0; k + sizeof(i) + sizeof(len) <= blen[j]; k += len) {
+	    memcpy(&i, buf[j] + k, sizeof(i));
+	    memcpy(&len, buf[j] + k + sizeof(i), sizeof(len));
+	    k += sizeof(i) + sizeof(len);
+	    if (i < 0 || i >= n || len > blen[j] - k) break;
+	    out[i] = buf[j] + k;
+	    outlen[i] = len;
+	}
+    for (i = 0; i < n; i++) {
+	if (i) printf("  ,\n");
+	if (out[i]) fwrite(out[i], 1, outlen[i], stdout);
+	else batch_item(item[i]);
+    }
+    for (j = 0; j < started; j++)
+	SFREE(buf[j]);
+    SFREE(buf);
+    SFREE(blen);
+    SFREE(bsize);
+    SFREE(out);
+    SFREE(outlen);
+    return (0);
+}
+#endif
+
+void batch(void)
+{
+    char *p, **item = NULL;
+    int i, n = 0, saved_validate = validate;
+#ifndef SANDBOX
+    int njobs;
+#endif
+
+    if (interactive) {
+	lwfail("Batch requests are not supported in interactive mode");
+	return;
+    }
+    while (p = get_param_multiple("item"))
+	if (n < BATCHMAX) {
+	    SREALLOC(item, n + 1, sizeof(char *));
+	    item[n] = NULL;
+	    SSTRCPY(item[n], p);
+	    n++;
+	}
+    if (n == 0) {
+	lwfail("Your request did not specify any items");
+	return;
+    }
+    batch_db = NULL;
+    SSTRCPY(batch_db, get_param("db"));
+
+    /* The items' validators aren't those of the whole response, so a
+       batch request is never answered with 304 Not Modified. */
+    validate = 0;
+    batching = 1;
+    printf("{ \"batch\":\n  [\n");
+#ifndef SANDBOX
+    if (p = getenv("LIGHTWAVE_BATCHJOBS"))
+	njobs = atoi(p);
+    else
+	njobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (njobs > BATCHJOBS) njobs = BATCHJOBS;
+    if (njobs > n) njobs = n;
+    if (njobs < 2 || batch_parallel(item, n, njobs) != 0)
+#endif
+	for (i = 0; i < n; i++) {
+	    if (i) printf("  ,\n");
+	    batch_item(item[i]);
+	    response_flush();
+	}
+    printf("  ],\n");
+    batching = 0;
+    validate = saved_validate;
+
+    /* Restore the batch request's own parameters. */
+    cgi_process_query(request_env("QUERY_STRING"));
+    action = get_param("action");
+    db = get_param("db");
+    for (i = 0; i < n; i++)
+	SFREE(item[i]);
+    SFREE(item);
+    SFREE(batch_db);
+    lwpass();
+}
+
+/* Answer one item of a batch request. */
+void batch_item(char *query)
+{
+    cache_reset();
+    cgi_process_query(query);
+    if ((action = get_param("action")) == NULL) action = "fetch";
+    if (select_db(batch_db) == NULL)
+	lwfail("Your request did not specify a database");
+    else if ((record = get_param("record")) == NULL)
+	lwfail("Your request did not specify a record");
+    else if (strcmp(action, "fetch") == 0)
+	cached(fetch);
+    else if (strcmp(action, "info") == 0)
+	cached(info);
+    else
+	lwfail("Your request did not specify a valid action");
+    release_request();
+}
+
 /* force_unique_signames() tries to ensure that each signal has a unique name.
    By default, the name of signal i is s[i].desc.  The names of any signals
    that are not unique are modified by appending a unique suffix to each
@@ -856,22 +3245,53 @@ int ufindsig(char *p) {
   return (-1);    
 }
 
-void cleanup(void)
+/* Close the current record and release the memory associated with it. */
+void release_record(void)
 {
-    /* Close open files and release allocated memory. */
+    pyr_close(pyr);
+    pyr = NULL;
+    pyr_checked = 0;
+    sigread_close(sigrd);
+    sigrd = NULL;
+    sigrd_checked = 0;
+    frame_pos = -1;
     wfdbquit();
+    signals_open = 0;
 
     SFREE(recpath);
+    meta_free(meta);	/* s and sname belong to meta */
+    meta = NULL;
+    s = NULL;
+    sname = NULL;
+    nsig = 0;
+}
+
+/* Release the memory associated with the current request's parameters. */
+void release_request(void)
+{
     while (--nann >= 0)
 	SFREE(annotator[nann]);
-
-    if (nsig > 0) {
-	SFREE(s);
-	SFREE(sigmap);
-    }
-    if (sname) {
-	while (--nsig >= 0)
-	    SFREE(sname[nsig]);
-	SFREE(sname);
+    nann = 0;
+    SFREE(sigmap);
+    action = db = record = NULL;
+    notmod = 0;
+    if (narrow_path) {
+	setwfdb(wfdb_path);
+	SFREE(narrow_path);
     }
+    nosig = 0;
+    npts = envmean = columns = streaming = 0;
+    alimit = 0;
+    binfmt = binraw = 0;
+    cgi_end();
+}
+
+void cleanup(void)
+{
+    /* Close open files and release allocated memory. */
+    release_request();
+    release_record();
+    release_rlist();
+    SFREE(ra_record);
+    SFREE(wfdb_path);
 }
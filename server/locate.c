@@ -0,0 +1,358 @@
+/* file: locate.c	B. Moody	18 October 2026
+
+Locations of databases in the LightWAVE server's WFDB path
+Copyright (C) 2026 Benjamin Moody
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Each time the WFDB library opens a file, it tries each component of
+the WFDB path in turn until it finds one that holds the file.  A
+database usually lives in only one of them, so every other component
+tried first costs a failed probe: a system call for a local directory,
+or a round trip for a remote repository.  A request may open a dozen
+files (the header, signal files, calibration, annotations, and the
+server's own lookups in note_deps), and all of them pay.
+
+This module works out which components of the path hold a database
+(those in which its directory exists, or, for a remote repository, in
+which its RECORDS file or directory can be found), and saves that list
+in the cache directory, so that the server can narrow the WFDB path to
+those components while it answers requests for the database.  Since
+only components that can't hold any of the database's files are
+dropped, the first component that holds a given file is the same as
+before (annotations in a local directory still take precedence over a
+remote copy of the database, for example).  The list is worked out
+again once it is more than LOCATE_TTL seconds old, so a database that
+is added to another component is noticed after at most that long.
+
+The module also saves negative entries for records whose headers
+couldn't be found anywhere in the path, so that repeated requests for
+a record that doesn't exist are answered without searching the path
+again, for LOCATE_MISS_TTL seconds.
+
+Each entry is a file named after a hash of its key (the kind of entry,
+the full WFDB path, and the database or record name), containing
+
+    LWLOC1
+    <key>
+    <time saved>
+    <value>
+
+where the value is the narrowed WFDB path (empty if the database was
+found nowhere) or, for a missing record, empty.  As in meta.c, files
+are written to a temporary name and renamed.  In FastCGI mode, the
+most recent list is also kept in memory.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <curl/curl.h>
+#include "locate.h"
+
+#define LOCATE_MAGIC "LWLOC1\n"
+
+static char *locate_dir;        /* NULL if the cache directory is disabled */
+static CURL *curl;              /* reused for each remote probe */
+
+/* The most recently used list (see locate_db). */
+static char *last_key, *last_value;
+static time_t last_saved;
+
+/* Enable saving locations in the given directory.  Returns 0 if
+   successful, or -1 if the directory can't be used. */
+int locate_init(const char *dir)
+{
+    struct stat st;
+
+    if (dir == NULL || dir[0] != '/' || stat(dir, &st) != 0
+        || !S_ISDIR(st.st_mode))
+        return -1;
+    free(locate_dir);
+    locate_dir = strdup(dir);
+    return (locate_dir ? 0 : -1);
+}
+
+/* Return an entry's key, made from its kind, the WFDB path, and the
+   name it describes. */
+static char *make_key(char kind, const char *wfdbpath, const char *name)
+{
+    char *key = malloc(strlen(wfdbpath) + strlen(name) + 4);
+
+    if (key)
+        sprintf(key, "%c\t%s\t%s", kind, wfdbpath, name);
+    return key;
+}
+
+/* Return the pathname of the file for an entry. */
+static char *entry_name(const char *key)
+{
+    unsigned long long h = 14695981039346656037ULL;
+    const char *p;
+    char *name = malloc(strlen(locate_dir) + 24);
+
+    for (p = key; *p; p++) {
+        h ^= (unsigned char) *p;
+        h *= 1099511628211ULL;
+    }
+    if (name)
+        sprintf(name, "%s/l%016llx", locate_dir, h);
+    return name;
+}
+
+/* Read the entry with the given key.  Returns 1, and sets *value (which
+   the caller must free) and *saved, if there is one that was saved less
+   than ttl seconds ago; otherwise returns 0. */
+static int load_entry(const char *key, long ttl, char **value, time_t *saved)
+{
+    struct stat st;
+    char *name, *buf, *p, *q, *end;
+    long long t;
+    time_t now = time(NULL);
+    int fd, ok = 0;
+
+    if ((name = entry_name(key)) == NULL)
+        return 0;
+    fd = open(name, O_RDONLY);
+    free(name);
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, &st) != 0 || (buf = malloc(st.st_size + 1)) == NULL) {
+        close(fd);
+        return 0;
+    }
+    if (read(fd, buf, st.st_size) == st.st_size) {
+        buf[st.st_size] = '\0';
+        end = buf + st.st_size;
+        p = buf + sizeof(LOCATE_MAGIC) - 1;
+        if (st.st_size > (off_t) sizeof(LOCATE_MAGIC)
+            && memcmp(buf, LOCATE_MAGIC, sizeof(LOCATE_MAGIC) - 1) == 0
+            && (q = strchr(p, '\n'))
+            && (size_t) (q - p) == strlen(key)
+            && memcmp(p, key, q - p) == 0
+            && sscanf(q + 1, "%lld", &t) == 1
+            && t <= now && now - t < ttl
+            && (p = strchr(q + 1, '\n'))
+            && (q = memchr(p + 1, '\n', end - p - 1))
+            && (*value = malloc(q - p)) != NULL) {
+            memcpy(*value, p + 1, q - p - 1);
+            (*value)[q - p - 1] = '\0';
+            *saved = t;
+            ok = 1;
+        }
+    }
+    close(fd);
+    free(buf);
+    return ok;
+}
+
+/* Save an entry. */
+static void save_entry(const char *key, const char *value, time_t saved)
+{
+    char *name, *tmp;
+    FILE *f;
+    int fd;
+
+    if ((name = entry_name(key)) == NULL)
+        return;
+    if ((tmp = malloc(strlen(name) + 8)) == NULL) {
+        free(name);
+        return;
+    }
+    sprintf(tmp, "%s.XXXXXX", name);
+    if ((fd = mkstemp(tmp)) >= 0) {
+        if ((f = fdopen(fd, "w")) == NULL)
+            close(fd);
+        else {
+            fprintf(f, "%s%s\n%lld\n%s\n", LOCATE_MAGIC, key,
+                    (long long) saved, value);
+            fchmod(fileno(f), 0644);
+            if (fclose(f) == 0 && rename(tmp, name) == 0)
+                tmp[0] = '\0';
+        }
+        if (tmp[0])
+            unlink(tmp);
+    }
+    free(tmp);
+    free(name);
+}
+
+/* Send a HEAD request for a URL, and return the HTTP status, or -1 if
+   the server can't be reached. */
+static long head_status(const char *url)
+{
+    long status = -1;
+
+    if (curl == NULL && (curl = curl_easy_init()) == NULL)
+        return -1;
+    curl_easy_reset(curl);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 30L);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long) LOCATE_TIMEOUT);
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "LightWAVE");
+    if (curl_easy_perform(curl) != CURLE_OK
+        || curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status)
+           != CURLE_OK)
+        return -1;
+    return status;
+}
+
+/* Return true unless a component of the WFDB path is known not to hold
+   a database.  A remote repository is assumed to hold it unless the
+   server says that neither its RECORDS file nor its directory exist. */
+static int holds(const char *component, size_t len, const char *db)
+{
+    struct stat st;
+    char *p = malloc(len + strlen(db) + 10);
+    long status;
+    int found = 1;
+
+    if (p == NULL)
+        return 1;
+    sprintf(p, "%.*s/%s", (int) len, component, db);
+    if (strstr(p, "://") == NULL)
+        found = (stat(p, &st) == 0 && S_ISDIR(st.st_mode));
+    else {
+        strcat(p, "/RECORDS");
+        status = head_status(p);
+        if (status == 404 || status == 410) {
+            strcpy(strrchr(p, '/') + 1, "");
+            status = head_status(p);
+            found = (status != 404 && status != 410);
+        }
+    }
+    free(p);
+    return found;
+}
+
+/* Return the components of the WFDB path that may hold a database, in
+   the same order, as a new WFDB path (which the caller must free).
+   Returns NULL if the path can't be narrowed (if the database was found
+   in every component, or in none, or if locations aren't being saved). */
+char *locate_db(const char *wfdbpath, const char *db)
+{
+    const char *p, *next;
+    char *key, *value = NULL;
+    size_t n = 0;
+    time_t saved;
+
+    if (locate_dir == NULL || (key = make_key('d', wfdbpath, db)) == NULL)
+        return NULL;
+    saved = time(NULL);
+    if (last_key && strcmp(key, last_key) == 0 && last_saved <= saved
+        && saved - last_saved < LOCATE_TTL) {
+        free(key);
+        key = NULL;
+        value = strdup(last_value);
+    }
+    else if (!load_entry(key, LOCATE_TTL, &value, &saved)) {
+        if ((value = malloc(strlen(wfdbpath) + 1)) == NULL) {
+            free(key);
+            return NULL;
+        }
+        for (p = wfdbpath; *p; p = next) {
+            for (next = p; *next && *next != ' '; next++)
+                ;
+            if (next > p && holds(p, next - p, db)) {
+                if (n) value[n++] = ' ';
+                memcpy(value + n, p, next - p);
+                n += next - p;
+            }
+            if (*next) next++;
+        }
+        value[n] = '\0';
+        save_entry(key, value, saved);
+    }
+    if (key && value) {
+        free(last_key);
+        free(last_value);
+        last_key = key;
+        last_value = strdup(value);
+        last_saved = saved;
+        if (last_value == NULL) {
+            free(last_key);
+            last_key = NULL;
+        }
+    }
+    else
+        free(key);
+    if (value && (*value == '\0' || strcmp(value, wfdbpath) == 0)) {
+        free(value);
+        value = NULL;
+    }
+    return value;
+}
+
+/* Note that a database may be in any component of the WFDB path (because
+   one of its records was found in a component that was thought not to
+   hold it), so that the path isn't narrowed for it until the entry is
+   worked out again. */
+void locate_everywhere(const char *wfdbpath, const char *db)
+{
+    char *key, *value;
+
+    if (locate_dir == NULL || (key = make_key('d', wfdbpath, db)) == NULL)
+        return;
+    if ((value = strdup(wfdbpath)) == NULL) {
+        free(key);
+        return;
+    }
+    free(last_key);
+    free(last_value);
+    last_key = key;
+    last_value = value;
+    last_saved = time(NULL);
+    save_entry(key, value, last_saved);
+}
+
+/* Return true if a record's header was recently found to be missing
+   from every component of the WFDB path. */
+int locate_missing(const char *wfdbpath, const char *name)
+{
+    char *key, *value;
+    time_t saved;
+    int missing;
+
+    if (locate_dir == NULL || (key = make_key('m', wfdbpath, name)) == NULL)
+        return 0;
+    if ((missing = load_entry(key, LOCATE_MISS_TTL, &value, &saved)))
+        free(value);
+    free(key);
+    return missing;
+}
+
+/* Called in a child process after fork(); see blkcache_forked. */
+void locate_forked(void)
+{
+    curl = NULL;
+}
+
+/* Note that a record's header couldn't be found anywhere in the WFDB
+   path. */
+void locate_note_missing(const char *wfdbpath, const char *name)
+{
+    char *key;
+
+    if (locate_dir == NULL || (key = make_key('m', wfdbpath, name)) == NULL)
+        return;
+    save_entry(key, "", time(NULL));
+    free(key);
+}
@@ -0,0 +1,42 @@
+/* file: locate.h	B. Moody	18 October 2026
+
+Locations of databases in the LightWAVE server's WFDB path
+Copyright (C) 2026 Benjamin Moody
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIGHTWAVE_LOCATE_H
+#define LIGHTWAVE_LOCATE_H
+
+/* The components of the WFDB path that hold a database are looked for
+   again if they were last found more than this many seconds ago. */
+#define LOCATE_TTL	600
+
+/* A record whose header couldn't be found anywhere in the WFDB path is
+   not looked for again for this many seconds. */
+#define LOCATE_MISS_TTL	60
+
+/* A server that hasn't answered a HEAD request within this many seconds
+   is treated as unreachable. */
+#define LOCATE_TIMEOUT	60
+
+int locate_init(const char *dir);
+char *locate_db(const char *wfdbpath, const char *db);
+void locate_everywhere(const char *wfdbpath, const char *db);
+int locate_missing(const char *wfdbpath, const char *name);
+void locate_note_missing(const char *wfdbpath, const char *name);
+void locate_forked(void);
+
+#endif
@@ -0,0 +1,114 @@
+/* file: lwpyramid.c	B. Moody	18 October 2026
+
+Create a multi-resolution signal summary ("pyramid") for a record
+Copyright (C) 2026 Benjamin Moody
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Usage:  lwpyramid [-b BASE] [-f FACTOR] [-o FILE] RECORD
+
+This program reads all of the samples of RECORD and writes its pyramid
+file (see pyramid.c), which allows the LightWAVE server to display long
+intervals of the record quickly.  By default, the pyramid is written to
+RECORD.lwpyr, in the same directory as the header file of RECORD (which
+must therefore be a local file).  The pyramid must be remade whenever the
+record's signal files are changed.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wfdb/wfdblib.h>
+#include "pyramid.h"
+
+static void usage(const char *pname)
+{
+    fprintf(stderr, "usage: %s [-b BASE] [-f FACTOR] [-o FILE] RECORD\n",
+            pname);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    char *record, *hea, *ofname = NULL, *tmpname;
+    int c, nsig;
+    long base = PYR_BASE, factor = PYR_FACTOR;
+    size_t len;
+    FILE *ofile;
+    WFDB_Siginfo *s;
+
+    while ((c = getopt(argc, argv, "b:f:o:")) != -1) {
+        switch (c) {
+        case 'b': base = atol(optarg); break;
+        case 'f': factor = atol(optarg); break;
+        case 'o': ofname = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || base < 1 || factor < 2)
+        usage(argv[0]);
+    record = argv[optind];
+
+    if ((nsig = isigopen(record, NULL, 0)) < 1) {
+        fprintf(stderr, "%s: record %s has no signals\n", argv[0], record);
+        exit(2);
+    }
+    s = calloc(nsig, sizeof(WFDB_Siginfo));
+    if (!s || isigopen(record, s, nsig) != nsig) {
+        fprintf(stderr, "%s: can't open signals of %s\n", argv[0], record);
+        exit(2);
+    }
+
+    /* Find the location of the header file, and replace its suffix. */
+    if (!ofname) {
+        if (!(hea = wfdbfile("hea", record)) || strstr(hea, "://")) {
+            fprintf(stderr, "%s: header of %s is not a local file;"
+                    " use -o to specify the output file\n", argv[0], record);
+            exit(2);
+        }
+        len = strlen(hea);
+        if (len < 4 || strcmp(hea + len - 4, ".hea") != 0
+            || !(ofname = malloc(len + sizeof(PYR_SUFFIX)))) {
+            fprintf(stderr, "%s: unexpected header file name %s\n",
+                    argv[0], hea);
+            exit(2);
+        }
+        sprintf(ofname, "%.*s.%s", (int) len - 4, hea, PYR_SUFFIX);
+    }
+
+    /* Write to a temporary file, so that the server never sees a
+       partially written pyramid. */
+    if (!(tmpname = malloc(strlen(ofname) + 5))) {
+        fprintf(stderr, "%s: insufficient memory\n", argv[0]);
+        exit(3);
+    }
+    sprintf(tmpname, "%s.tmp", ofname);
+    if (!(ofile = fopen(tmpname, "wb"))) {
+        perror(tmpname);
+        exit(3);
+    }
+    if (pyr_write(ofile, s, nsig, base, factor) != 0 || fclose(ofile) != 0) {
+        fprintf(stderr, "%s: error writing %s\n", argv[0], tmpname);
+        remove(tmpname);
+        exit(3);
+    }
+    if (rename(tmpname, ofname) != 0) {
+        perror(ofname);
+        remove(tmpname);
+        exit(3);
+    }
+    wfdbquit();
+    return 0;
+}
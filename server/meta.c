@@ -0,0 +1,408 @@
+/* file: meta.c	B. Moody	18 October 2026
+
+Record metadata cache for the LightWAVE server
+Copyright (C) 2026 Benjamin Moody
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+Before it can answer an info or fetch request, the server must read
+the record's header (twice: once to count the signals, and again to
+open them) and the calibration file, and work out unique signal names
+and the record's tick frequency.  For a record on a remote server,
+each of those reads is an HTTP request.  This module saves the results
+(a RECMETA structure) in a compact binary file in the cache directory,
+so that later requests for the same record can skip all of that; an
+info request can then be answered without opening the record at all.
+
+Each file is named after a hash of the record name, and contains (in
+the machine's native byte order, since it is only read by the machine
+that wrote it):
+
+    "LWMETA1\n"
+    record name, header pathname
+    header modification time and size, time saved (64-bit integers)
+    ffreq, tfreq (doubles)
+    nseg, nsig, nnote (32-bit integers)
+    start, end, duration
+    for each signal:
+        fname, desc, units, unique name
+        gain, scale (doubles)
+        initval, group, fmt, spf, bsize, adcres, adczero, baseline,
+          cksum (32-bit integers)
+        nsamp (64-bit integer)
+    notes
+
+where each string is a 32-bit length (-1 for NULL) followed by its
+characters.  A file is used only if the header is a local file whose
+size and modification time are unchanged, or otherwise, if the file
+was saved less than META_TTL seconds ago.  Metadata for multi-segment
+records (which depend on the segments' headers too) are never saved.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "meta.h"
+
+#define META_MAGIC "LWMETA1\n"
+
+static char *meta_dir;          /* NULL if the cache directory is disabled */
+
+/* Enable saving metadata in the given directory.  Returns 0 if
+   successful, or -1 if the directory can't be used. */
+int meta_init(const char *dir)
+{
+    struct stat st;
+
+    if (dir == NULL || dir[0] != '/' || stat(dir, &st) != 0
+        || !S_ISDIR(st.st_mode))
+        return -1;
+    free(meta_dir);
+    meta_dir = strdup(dir);
+    return (meta_dir ? 0 : -1);
+}
+
+/* Return the pathname of the metadata file for a record. */
+static char *meta_name(const char *record)
+{
+    unsigned long long h = 14695981039346656037ULL;
+    const char *p;
+    char *name = malloc(strlen(meta_dir) + 24);
+
+    for (p = record; *p; p++) {
+        h ^= (unsigned char) *p;
+        h *= 1099511628211ULL;
+    }
+    if (name)
+        sprintf(name, "%s/m%016llx", meta_dir, h);
+    return name;
+}
+
+/* Free a RECMETA structure and everything it contains. */
+void meta_free(RECMETA *m)
+{
+    int i;
+
+    if (m == NULL)
+        return;
+    if (m->s) {
+        for (i = 0; i < m->nsig; i++) {
+            free(m->s[i].fname);
+            free(m->s[i].desc);
+            free(m->s[i].units);
+        }
+        free(m->s);
+    }
+    if (m->sname) {
+        for (i = 0; i < m->nsig; i++)
+            free(m->sname[i]);
+        free(m->sname);
+    }
+    if (m->note) {
+        for (i = 0; i < m->nnote; i++)
+            free(m->note[i]);
+        free(m->note);
+    }
+    free(m->scale);
+    free(m->hea);
+    free(m->start);
+    free(m->end);
+    free(m->duration);
+    free(m);
+}
+
+/* Reading a metadata file: each get_*() function takes the next item
+   from the buffer, or sets r->err if there isn't one. */
+struct reader {
+    const char *p, *end;
+    int err;
+};
+
+static void get_bytes(struct reader *r, void *x, size_t n)
+{
+    if (r->err || (size_t) (r->end - r->p) < n) {
+        r->err = 1;
+        memset(x, 0, n);
+        return;
+    }
+    memcpy(x, r->p, n);
+    r->p += n;
+}
+
+static int get_int(struct reader *r)
+{
+    int x;
+
+    get_bytes(r, &x, sizeof(x));
+    return x;
+}
+
+static long long get_llong(struct reader *r)
+{
+    long long x;
+
+    get_bytes(r, &x, sizeof(x));
+    return x;
+}
+
+static double get_double(struct reader *r)
+{
+    double x;
+
+    get_bytes(r, &x, sizeof(x));
+    return x;
+}
+
+static char *get_string(struct reader *r)
+{
+    int n = get_int(r);
+    char *s;
+
+    if (r->err || n < 0)
+        return NULL;
+    if (n > r->end - r->p || (s = malloc(n + 1)) == NULL) {
+        r->err = 1;
+        return NULL;
+    }
+    memcpy(s, r->p, n);
+    s[n] = '\0';
+    r->p += n;
+    return s;
+}
+
+/* Allocate a zeroed array of n elements of the given size, or set
+   r->err if that isn't possible. */
+static void *get_array(struct reader *r, int n, size_t size)
+{
+    void *a;
+
+    if (r->err || n < 0 || (size_t) n > (size_t) (r->end - r->p) / 4)
+        r->err = 1;
+    else if ((a = calloc(n ? n : 1, size)) == NULL)
+        r->err = 1;
+    else
+        return a;
+    return NULL;
+}
+
+/* Return true if the metadata were made from the current version of the
+   header. */
+static int meta_current(const char *hea, long long mtime, long long size,
+                        long long saved)
+{
+    struct stat st;
+    time_t now = time(NULL);
+
+    if (hea == NULL)
+        return 0;
+    if (strstr(hea, "://"))
+        return (saved <= now && now - saved < META_TTL);
+    return (stat(hea, &st) == 0 && st.st_mtime == mtime
+            && st.st_size == size);
+}
+
+/* Return the saved metadata for a record, or NULL if there are none (or
+   they are out of date).  The caller must free the result using
+   meta_free(). */
+RECMETA *meta_load(const char *record)
+{
+    struct reader r;
+    struct stat st;
+    RECMETA *m = NULL;
+    char *name, *buf = NULL, *rec;
+    long long mtime, size, saved;
+    int fd, i;
+
+    if (meta_dir == NULL || (name = meta_name(record)) == NULL)
+        return NULL;
+    fd = open(name, O_RDONLY);
+    free(name);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(META_MAGIC)
+        || (buf = malloc(st.st_size)) == NULL
+        || read(fd, buf, st.st_size) != st.st_size
+        || memcmp(buf, META_MAGIC, sizeof(META_MAGIC) - 1) != 0
+        || (m = calloc(1, sizeof(RECMETA))) == NULL) {
+        close(fd);
+        free(buf);
+        return NULL;
+    }
+    close(fd);
+
+    r.p = buf + sizeof(META_MAGIC) - 1;
+    r.end = buf + st.st_size;
+    r.err = 0;
+    rec = get_string(&r);
+    if (rec == NULL || strcmp(rec, record) != 0)
+        r.err = 1;
+    free(rec);
+    m->hea = get_string(&r);
+    mtime = get_llong(&r);
+    size = get_llong(&r);
+    saved = get_llong(&r);
+    if (!r.err && !meta_current(m->hea, mtime, size, saved))
+        r.err = 1;
+
+    m->ffreq = get_double(&r);
+    m->tfreq = get_double(&r);
+    m->nseg = get_int(&r);
+    m->nsig = get_int(&r);
+    m->nnote = get_int(&r);
+    m->start = get_string(&r);
+    m->end = get_string(&r);
+    m->duration = get_string(&r);
+
+    m->s = get_array(&r, m->nsig, sizeof(WFDB_Siginfo));
+    m->sname = get_array(&r, m->nsig, sizeof(char *));
+    m->scale = get_array(&r, m->nsig, sizeof(double));
+    for (i = 0; i < m->nsig && !r.err; i++) {
+        m->s[i].fname = get_string(&r);
+        m->s[i].desc = get_string(&r);
+        m->s[i].units = get_string(&r);
+        m->sname[i] = get_string(&r);
+        m->s[i].gain = get_double(&r);
+        m->scale[i] = get_double(&r);
+        m->s[i].initval = get_int(&r);
+        m->s[i].group = get_int(&r);
+        m->s[i].fmt = get_int(&r);
+        m->s[i].spf = get_int(&r);
+        m->s[i].bsize = get_int(&r);
+        m->s[i].adcres = get_int(&r);
+        m->s[i].adczero = get_int(&r);
+        m->s[i].baseline = get_int(&r);
+        m->s[i].cksum = get_int(&r);
+        m->s[i].nsamp = get_llong(&r);
+        if (m->s[i].desc == NULL || m->sname[i] == NULL)
+            r.err = 1;
+    }
+
+    m->note = get_array(&r, m->nnote, sizeof(char *));
+    for (i = 0; i < m->nnote && !r.err; i++)
+        if ((m->note[i] = get_string(&r)) == NULL)
+            r.err = 1;
+
+    free(buf);
+    if (r.err || r.p != r.end) {
+        if (m->s == NULL || m->sname == NULL)
+            m->nsig = 0;
+        if (m->note == NULL)
+            m->nnote = 0;
+        meta_free(m);
+        return NULL;
+    }
+    return m;
+}
+
+/* Writing a metadata file. */
+static void put_int(FILE *f, int x)
+{
+    fwrite(&x, sizeof(x), 1, f);
+}
+
+static void put_llong(FILE *f, long long x)
+{
+    fwrite(&x, sizeof(x), 1, f);
+}
+
+static void put_double(FILE *f, double x)
+{
+    fwrite(&x, sizeof(x), 1, f);
+}
+
+static void put_string(FILE *f, const char *s)
+{
+    if (s == NULL)
+        put_int(f, -1);
+    else {
+        put_int(f, strlen(s));
+        fputs(s, f);
+    }
+}
+
+/* Save the metadata for a record, if they can be checked later. */
+void meta_save(const RECMETA *m, const char *record)
+{
+    struct stat st;
+    char *name, *tmp;
+    FILE *f;
+    int fd, i;
+
+    if (meta_dir == NULL || m->hea == NULL || m->nseg > 0)
+        return;
+    if (strstr(m->hea, "://")) {
+        st.st_mtime = 0;
+        st.st_size = 0;
+    }
+    else if (stat(m->hea, &st) != 0)
+        return;
+    if ((name = meta_name(record)) == NULL)
+        return;
+    if ((tmp = malloc(strlen(name) + 8)) == NULL) {
+        free(name);
+        return;
+    }
+    sprintf(tmp, "%s.XXXXXX", name);
+    if ((fd = mkstemp(tmp)) >= 0) {
+        if ((f = fdopen(fd, "wb")) == NULL)
+            close(fd);
+        else {
+            fputs(META_MAGIC, f);
+            put_string(f, record);
+            put_string(f, m->hea);
+            put_llong(f, st.st_mtime);
+            put_llong(f, st.st_size);
+            put_llong(f, time(NULL));
+            put_double(f, m->ffreq);
+            put_double(f, m->tfreq);
+            put_int(f, m->nseg);
+            put_int(f, m->nsig);
+            put_int(f, m->nnote);
+            put_string(f, m->start);
+            put_string(f, m->end);
+            put_string(f, m->duration);
+            for (i = 0; i < m->nsig; i++) {
+                put_string(f, m->s[i].fname);
+                put_string(f, m->s[i].desc);
+                put_string(f, m->s[i].units);
+                put_string(f, m->sname[i]);
+                put_double(f, m->s[i].gain);
+                put_double(f, m->scale[i]);
+                put_int(f, m->s[i].initval);
+                put_int(f, m->s[i].group);
+                put_int(f, m->s[i].fmt);
+                put_int(f, m->s[i].spf);
+                put_int(f, m->s[i].bsize);
+                put_int(f, m->s[i].adcres);
+                put_int(f, m->s[i].adczero);
+                put_int(f, m->s[i].baseline);
+                put_int(f, m->s[i].cksum);
+                put_llong(f, m->s[i].nsamp);
+            }
+            for (i = 0; i < m->nnote; i++)
+                put_string(f, m->note[i]);
+            fchmod(fileno(f), 0644);
+            if (fclose(f) == 0 && rename(tmp, name) == 0)
+                tmp[0] = '\0';
+        }
+        if (tmp[0])
+            unlink(tmp);
+    }
+    free(tmp);
+    free(name);
+}
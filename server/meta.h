@@ -0,0 +1,53 @@
+/* file: meta.h	B. Moody	18 October 2026
+
+Record metadata cache for the LightWAVE server
+Copyright (C) 2026 Benjamin Moody
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIGHTWAVE_META_H
+#define LIGHTWAVE_META_H
+
+#include <wfdb/wfdb.h>
+
+/* Saved metadata for a record whose header isn't a local file (so that
+   its modification time can't be checked) are used for at most this
+   many seconds. */
+#define META_TTL	3600
+
+/* Everything about a record that the server needs before reading any
+   samples or annotations.  All of the strings and arrays belong to the
+   structure, and are freed by meta_free(). */
+typedef struct {
+    char *hea;			/* pathname or URL of the header file */
+    int nseg;			/* number of segments (0 if not multi-segment) */
+    WFDB_Frequency ffreq;	/* frame frequency */
+    WFDB_Frequency tfreq;	/* "tick" frequency (see prep_signals) */
+    char *start, *end;		/* formatted start and end times, or NULL */
+    char *duration;		/* formatted duration, or NULL */
+    int nsig;			/* number of signals */
+    WFDB_Siginfo *s;		/* signal information */
+    char **sname;		/* unique signal names */
+    double *scale;		/* calibration scale factors */
+    int nnote;			/* number of info strings */
+    char **note;		/* info strings from the header */
+} RECMETA;
+
+int meta_init(const char *dir);
+RECMETA *meta_load(const char *record);
+void meta_save(const RECMETA *m, const char *record);
+void meta_free(RECMETA *m);
+
+#endif
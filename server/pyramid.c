@@ -0,0 +1,342 @@
+/* file: pyramid.c	B. Moody	18 October 2026
+
+Multi-resolution signal summaries ("pyramids") for the LightWAVE server
+Copyright (C) 2026 Benjamin Moody
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+A pyramid file contains the minimum, maximum, and mean of each signal of
+a record over consecutive intervals ("buckets") of equal length, at
+several resolutions ("levels").  Level 0 has buckets of `base' frames,
+and each following level has buckets `factor' times as long as the
+level before it; the last level has a single bucket covering the whole
+record.  The server (see fetchpyramid() in lightwave.c) uses these to
+produce the envelope of a long interval of a record in time proportional
+to the size of the output, rather than the length of the interval.
+
+The file format is (all integers are little-endian):
+
+    magic       8 bytes         "LWPYR" 0x01 0x0d 0x0a
+    nsig        uint32          number of signals
+    nlevels     uint32          number of levels
+    base        uint32          frames per bucket in level 0
+    factor      uint32          ratio of bucket lengths in successive levels
+    nframes     int64           number of frames summarized
+    nsig signal descriptions, each:
+      spf       int32           samples per frame
+      fmt       int32           storage format
+      cksum     int32           checksum, from the header file
+      reserved  int32           zero
+      nsamp     int64           number of samples, from the header file
+    nlevels level descriptions, each:
+      nbuckets  int64           number of buckets
+      offset    int64           file offset of level data
+    level data, for each level in turn:
+      for each signal, for each bucket:
+        min     int32           smallest valid sample in bucket
+        max     int32           largest valid sample in bucket
+        mean    int32           mean of valid samples in bucket, rounded
+
+Buckets that contain no valid samples have min, max, and mean all equal
+to WFDB_INVALID_SAMPLE.  The signal descriptions are used to check that
+the pyramid matches the record; a pyramid that doesn't (for example,
+because the record was rewritten after the pyramid was made) is ignored.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <wfdb/wfdblib.h>
+#include "pyramid.h"
+
+#define PYR_MAGIC	"LWPYR\001\r\n"
+#define PYR_HEADLEN	32	/* size of fixed part of file header */
+#define PYR_SIGLEN	24	/* size of each signal description */
+#define PYR_LEVLEN	16	/* size of each level description */
+#define PYR_RECLEN	12	/* size of each bucket record */
+#define PYR_MAXLEVELS	32
+
+struct pyramid {
+    WFDB_FILE *file;
+    int nsig, nlevels;
+    long base, factor;
+    long long nframes;
+    long long nbuckets[PYR_MAXLEVELS];
+    long long offset[PYR_MAXLEVELS];
+    long long bucket[PYR_MAXLEVELS];	/* frames per bucket */
+};
+
+static long long get_le(const unsigned char *p, int n)
+{
+    unsigned long long x = 0;
+    int i;
+
+    for (i = n - 1; i >= 0; i--)
+	x = (x << 8) | p[i];
+    if (n < 8 && (x & (1ULL << (8*n - 1))))
+	x |= ~0ULL << (8*n);	/* sign extension */
+    return ((long long)x);
+}
+
+static void put_le(unsigned char *p, long long x, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++, x >>= 8)
+	p[i] = x & 0xff;
+}
+
+/* Open the pyramid for a record, if there is one, and check that it
+   matches the signals of the record (as returned by isigopen). */
+PYR *pyr_open(char *record, WFDB_Siginfo *s, int nsig)
+{
+    unsigned char hdr[PYR_HEADLEN], buf[PYR_SIGLEN];
+    WFDB_FILE *file;
+    PYR *p = NULL;
+    int i;
+
+    if (nsig < 1 || (file = wfdb_open(PYR_SUFFIX, record, WFDB_READ)) == NULL)
+	return (NULL);
+    if (wfdb_fread(hdr, 1, sizeof(hdr), file) != sizeof(hdr) ||
+	memcmp(hdr, PYR_MAGIC, 8) != 0 || get_le(hdr+8, 4) != nsig)
+	goto bad;
+    SUALLOC(p, 1, sizeof(PYR));
+    p->file = file;
+    p->nsig = nsig;
+    p->nlevels = get_le(hdr+12, 4);
+    p->base = get_le(hdr+16, 4);
+    p->factor = get_le(hdr+20, 4);
+    p->nframes = get_le(hdr+24, 8);
+    if (p->nlevels < 1 || p->nlevels > PYR_MAXLEVELS || p->base < 1 ||
+	p->factor < 2 || p->nframes < 0)
+	goto bad;
+    for (i = 0; i < nsig; i++) {
+	if (wfdb_fread(buf, 1, PYR_SIGLEN, file) != PYR_SIGLEN ||
+	    get_le(buf, 4) != s[i].spf || get_le(buf+4, 4) != s[i].fmt ||
+	    get_le(buf+8, 4) != s[i].cksum || get_le(buf+16, 8) != s[i].nsamp)
+	    goto bad;
+    }
+    for (i = 0; i < p->nlevels; i++) {
+	if (wfdb_fread(buf, 1, PYR_LEVLEN, file) != PYR_LEVLEN)
+	    goto bad;
+	p->nbuckets[i] = get_le(buf, 8);
+	p->offset[i] = get_le(buf+8, 8);
+	p->bucket[i] = i ? p->bucket[i-1] * p->factor : p->base;
+    }
+    return (p);
+
+  bad:
+    SFREE(p);
+    wfdb_fclose(file);
+    return (NULL);
+}
+
+void pyr_close(PYR *p)
+{
+    if (p) {
+	wfdb_fclose(p->file);
+	SFREE(p);
+    }
+}
+
+/* Return the number of frames per bucket in the finest level. */
+long pyr_base(PYR *p)
+{
+    return (p->base);
+}
+
+/* Return the number of frames per bucket in the given level. */
+long pyr_bucket(PYR *p, int level)
+{
+    return (p->bucket[level]);
+}
+
+/* Return the number of buckets (of each signal) in the given level. */
+long pyr_buckets(PYR *p, int level)
+{
+    return (p->nbuckets[level]);
+}
+
+/* Choose the finest level that yields no more than npts buckets (including
+   partial buckets at each end) for an interval of nframes frames.  Return
+   -1 if the finest level is too coarse to be useful (in which case the
+   envelope should be computed from the samples.) */
+int pyr_level(PYR *p, long nframes, long npts)
+{
+    int i;
+
+    if (npts < 2 || nframes / npts < p->base)
+	return (-1);
+    for (i = 0; i < p->nlevels; i++)
+	if (nframes / p->bucket[i] + 2 <= npts)
+	    return (i);
+    return (p->nlevels - 1);
+}
+
+/* Read buckets b0 through b0+nb-1 of a signal, at the given level.  Return
+   the number of buckets read. */
+long pyr_read(PYR *p, int level, int sig, long b0, long nb,
+	      WFDB_Sample *min, WFDB_Sample *max, WFDB_Sample *mean)
+{
+    unsigned char buf[PYR_RECLEN * 256];
+    long i, j, k, n = 0;
+
+    if (b0 < 0 || b0 >= p->nbuckets[level])
+	return (0);
+    if (nb > p->nbuckets[level] - b0)
+	nb = p->nbuckets[level] - b0;
+    if (wfdb_fseek(p->file, (long)(p->offset[level] +
+		   ((long long)sig * p->nbuckets[level] + b0) * PYR_RECLEN),
+		   SEEK_SET) != 0)
+	return (0);
+    while (n < nb) {
+	k = nb - n;
+	if (k > 256) k = 256;
+	if ((j = wfdb_fread(buf, PYR_RECLEN, k, p->file)) <= 0)
+	    break;
+	for (i = 0; i < j; i++, n++) {
+	    min[n] = get_le(buf + PYR_RECLEN*i, 4);
+	    max[n] = get_le(buf + PYR_RECLEN*i + 4, 4);
+	    if (mean) mean[n] = get_le(buf + PYR_RECLEN*i + 8, 4);
+	}
+    }
+    return (n);
+}
+
+/* Accumulated statistics for one bucket during pyr_write(). */
+struct acc {
+    WFDB_Sample lo, hi;
+    long long sum;
+    long n;
+};
+
+static void acc_merge(struct acc *a, const struct acc *b)
+{
+    if (b->n > 0) {
+	if (a->n == 0 || b->lo < a->lo) a->lo = b->lo;
+	if (a->n == 0 || b->hi > a->hi) a->hi = b->hi;
+	a->sum += b->sum;
+	a->n += b->n;
+    }
+}
+
+/* Read all frames of the currently open record (from the current position)
+   and write its pyramid to ofile.  Returns 0 on success, -1 on error. */
+int pyr_write(FILE *ofile, WFDB_Siginfo *s, int nsig, long base, long factor)
+{
+    unsigned char buf[PYR_SIGLEN];
+    struct acc **lev[PYR_MAXLEVELS], *a;
+    long long nframes = 0, nb[PYR_MAXLEVELS], cap = 0, offset, b;
+    int framelen, i, j, k, l, n, nlevels;
+    WFDB_Sample *v, y;
+
+    if (nsig < 1 || base < 1 || factor < 2)
+	return (-1);
+    for (n = framelen = 0; n < nsig; n++)
+	framelen += s[n].spf;
+    SUALLOC(v, framelen, sizeof(WFDB_Sample));
+    SUALLOC(lev[0], nsig, sizeof(struct acc *));
+
+    /* Compute level 0 from the samples. */
+    while (getframe(v) > 0) {
+	b = nframes / base;
+	if (b >= cap) {
+	    long long oldcap = cap;
+
+	    cap = cap ? 2*cap : 1024;
+	    for (n = 0; n < nsig; n++) {
+		SREALLOC(lev[0][n], cap, sizeof(struct acc));
+		memset(lev[0][n] + oldcap, 0,
+		       (cap - oldcap) * sizeof(struct acc));
+	    }
+	}
+	for (n = i = 0; n < nsig; n++) {
+	    a = &lev[0][n][b];
+	    for (j = 0; j < s[n].spf; j++) {
+		if ((y = v[i++]) == WFDB_INVALID_SAMPLE)
+		    continue;
+		if (a->n == 0 || y < a->lo) a->lo = y;
+		if (a->n == 0 || y > a->hi) a->hi = y;
+		a->sum += y;
+		a->n++;
+	    }
+	}
+	nframes++;
+    }
+    SFREE(v);
+    if (nframes == 0) {
+	SFREE(lev[0]);
+	return (-1);
+    }
+    nb[0] = (nframes + base - 1) / base;
+
+    /* Compute each coarser level from the one before it. */
+    for (l = 1; nb[l-1] > 1 && l < PYR_MAXLEVELS; l++) {
+	nb[l] = (nb[l-1] + factor - 1) / factor;
+	SUALLOC(lev[l], nsig, sizeof(struct acc *));
+	for (n = 0; n < nsig; n++) {
+	    SUALLOC(lev[l][n], nb[l], sizeof(struct acc));
+	    for (b = 0; b < nb[l-1]; b++)
+		acc_merge(&lev[l][n][b / factor], &lev[l-1][n][b]);
+	}
+    }
+    nlevels = l;
+
+    /* Write the headers. */
+    memcpy(buf, PYR_MAGIC, 8);
+    fwrite(buf, 1, 8, ofile);
+    put_le(buf, nsig, 4);
+    put_le(buf+4, nlevels, 4);
+    put_le(buf+8, base, 4);
+    put_le(buf+12, factor, 4);
+    put_le(buf+16, nframes, 8);
+    fwrite(buf, 1, PYR_HEADLEN - 8, ofile);
+    for (n = 0; n < nsig; n++) {
+	put_le(buf, s[n].spf, 4);
+	put_le(buf+4, s[n].fmt, 4);
+	put_le(buf+8, s[n].cksum, 4);
+	put_le(buf+12, 0, 4);
+	put_le(buf+16, s[n].nsamp, 8);
+	fwrite(buf, 1, PYR_SIGLEN, ofile);
+    }
+    offset = PYR_HEADLEN + (long long)nsig*PYR_SIGLEN + nlevels*PYR_LEVLEN;
+    for (l = 0; l < nlevels; l++) {
+	put_le(buf, nb[l], 8);
+	put_le(buf+8, offset, 8);
+	fwrite(buf, 1, PYR_LEVLEN, ofile);
+	offset += nb[l] * nsig * PYR_RECLEN;
+    }
+
+    /* Write the level data. */
+    for (l = 0; l < nlevels; l++) {
+	for (n = 0; n < nsig; n++) {
+	    for (b = 0; b < nb[l]; b++) {
+		a = &lev[l][n][b];
+		if (a->n > 0) {
+		    put_le(buf, a->lo, 4);
+		    put_le(buf+4, a->hi, 4);
+		    put_le(buf+8, (long long)floor((double)a->sum/a->n + 0.5), 4);
+		}
+		else
+		    for (k = 0; k < 3; k++)
+			put_le(buf+4*k, WFDB_INVALID_SAMPLE, 4);
+		fwrite(buf, 1, PYR_RECLEN, ofile);
+	    }
+	    SFREE(lev[l][n]);
+	}
+	SFREE(lev[l]);
+    }
+    return (ferror(ofile) ? -1 : 0);
+}
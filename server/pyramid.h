@@ -0,0 +1,47 @@
+/* file: pyramid.h	B. Moody	18 October 2026
+
+Multi-resolution signal summaries ("pyramids") for the LightWAVE server
+Copyright (C) 2026 Benjamin Moody
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIGHTWAVE_PYRAMID_H
+#define LIGHTWAVE_PYRAMID_H
+
+#include <wfdb/wfdb.h>
+
+/* File type (suffix) of pyramid files; the pyramid for record "mitdb/200"
+   is "mitdb/200.lwpyr", found in the WFDB path like any other file
+   belonging to the record. */
+#define PYR_SUFFIX	"lwpyr"
+
+/* Default bucket size (in frames) of level 0, and ratio between bucket
+   sizes of successive levels. */
+#define PYR_BASE	64
+#define PYR_FACTOR	4
+
+typedef struct pyramid PYR;
+
+PYR *pyr_open(char *record, WFDB_Siginfo *s, int nsig);
+void pyr_close(PYR *p);
+long pyr_base(PYR *p);
+int pyr_level(PYR *p, long nframes, long npts);
+long pyr_bucket(PYR *p, int level);
+long pyr_buckets(PYR *p, int level);
+long pyr_read(PYR *p, int level, int sig, long b0, long nb,
+	      WFDB_Sample *min, WFDB_Sample *max, WFDB_Sample *mean);
+int pyr_write(FILE *ofile, WFDB_Siginfo *s, int nsig, long base, long factor);
+
+#endif
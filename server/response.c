@@ -0,0 +1,392 @@
+/* file: response.c	B. Moody	18 October 2026
+
+Buffered and compressed responses for the LightWAVE server
+Copyright (C) 2026 Benjamin Moody
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+The functions in lightwave.c write the body of a response to stdout
+using ordinary stdio functions.  Between response_begin() and
+response_end(), stdout is redirected to a buffer in memory (glibc
+allows reassigning stdout), so that the complete body is available
+before anything is sent.  This allows the body to be compressed, if
+the client allows it, and its length to be given in the
+Content-Length header.
+
+If the client makes a conditional request, and already has the current
+version of the response, response_validate() marks the response as
+"304 Not Modified", and the body is discarded.
+
+A long response can instead be streamed (see response_stream()): the
+headers, and each part of the body, are sent as soon as
+response_flush() finds that enough of the body has been written, so
+that the client can start using it before it is complete.  A streamed
+response has no Content-Length header, and if it is compressed, each
+part is compressed separately, with a "sync flush" after it.  Once a
+part has been sent, it is discarded, so that the memory needed for a
+streamed response doesn't depend on its length (and so
+response_body() can no longer return it).
+*/
+
+#define _GNU_SOURCE             /* for strptime and timegm */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <zlib.h>
+#include "response.h"
+
+static FILE *saved_stdout;      /* real stdout, while a response is open */
+static char *body;              /* response body */
+static size_t body_len;
+static size_t body_base;        /* length of the body discarded so far */
+static char headers[2048];      /* response headers, "Name: value\r\n" */
+static size_t headers_len;
+static int not_modified;        /* true if the response is a 304 */
+static const char *accept_enc;  /* client's Accept-Encoding header */
+static void (*write_fn)(const void *data, size_t len);
+static int streaming;           /* true if response_stream(1) was called */
+static int headers_sent;        /* true once a streamed response has begun */
+static size_t body_sent;        /* length of the body sent so far */
+static const char *stream_enc;  /* content coding of a streamed response */
+static z_stream stream_z;
+
+static void write_stdout(const void *data, size_t len)
+{
+    fwrite(data, 1, len, saved_stdout ? saved_stdout : stdout);
+}
+
+/* Start collecting a response, which will be sent (headers and body)
+   using out_fn, or to stdout if out_fn is NULL.  accept_encoding is the
+   value of the client's Accept-Encoding header, if any.  Returns 0 if
+   successful, or -1 if the buffer couldn't be allocated (in which case
+   output goes to stdout as usual). */
+int response_begin(const char *accept_encoding,
+                   void (*out_fn)(const void *data, size_t len))
+{
+    headers_len = 0;
+    headers[0] = '\0';
+    not_modified = 0;
+    accept_enc = accept_encoding;
+    write_fn = out_fn ? out_fn : write_stdout;
+    streaming = headers_sent = 0;
+    body_sent = body_base = 0;
+    stream_enc = NULL;
+    fflush(stdout);
+    saved_stdout = stdout;
+    if ((stdout = open_memstream(&body, &body_len)) == NULL) {
+        stdout = saved_stdout;
+        saved_stdout = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/* Add a header to the current response.  Headers that don't fit in the
+   header buffer are silently dropped. */
+void response_header(const char *name, const char *value)
+{
+    size_t avail = sizeof(headers) - headers_len;
+    int n = snprintf(headers + headers_len, avail, "%s: %s\r\n", name, value);
+
+    if (n > 0 && (size_t) n < avail)
+        headers_len += n;
+    else
+        headers[headers_len] = '\0';
+}
+
+/* Return the length of the body written so far. */
+size_t response_tell(void)
+{
+    if (saved_stdout == NULL)
+        return 0;
+    fflush(stdout);
+    return body_base + body_len;
+}
+
+/* Return a pointer to the part of the body following the first start
+   bytes, and set *len to its length.  The pointer is valid until the
+   next output to stdout.  Returns NULL if any of that part of the body
+   has already been streamed (and discarded). */
+const char *response_body(size_t start, size_t *len)
+{
+    if (saved_stdout == NULL || start > response_tell() || start < body_base) {
+        *len = 0;
+        return NULL;
+    }
+    *len = body_base + body_len - start;
+    return body + (start - body_base);
+}
+
+/* Return true if etag matches one of the entity tags listed in the value
+   of an If-None-Match header (using the weak comparison function, since
+   the same tag is used for compressed and uncompressed responses). */
+static int etag_match(const char *list, const char *etag)
+{
+    size_t n;
+
+    if (strncmp(etag, "W/", 2) == 0)
+        etag += 2;
+    n = strlen(etag);
+    while (*list) {
+        list += strspn(list, " \t,");
+        if (*list == '*')
+            return 1;
+        if (strncmp(list, "W/", 2) == 0)
+            list += 2;
+        if (strncmp(list, etag, n) == 0 && strchr(" \t,", list[n]))
+            return 1;
+        list += strcspn(list, ",");
+    }
+    return 0;
+}
+
+/* Add validators (an entity tag, and the modification time if it is
+   nonzero) to the current response.  If the client's If-None-Match or
+   If-Modified-Since header shows that it already has this version of the
+   response, mark the response "304 Not Modified" and return 1; otherwise
+   return 0. */
+int response_validate(const char *etag, time_t last_modified,
+                      const char *if_none_match,
+                      const char *if_modified_since)
+{
+    char date[64];
+    struct tm tm;
+
+    response_header("ETag", etag);
+    if (last_modified > 0) {
+        strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT",
+                 gmtime(&last_modified));
+        response_header("Last-Modified", date);
+    }
+    /* If-Modified-Since is ignored if If-None-Match is present. */
+    if (if_none_match)
+        not_modified = etag_match(if_none_match, etag);
+    else if (if_modified_since && last_modified > 0) {
+        memset(&tm, 0, sizeof(tm));
+        if (strptime(if_modified_since, "%a, %d %b %Y %H:%M:%S GMT", &tm)
+            && timegm(&tm) >= last_modified)
+            not_modified = 1;
+    }
+    return not_modified;
+}
+
+/* Return true if the value of an Accept-Encoding header allows the
+   named content coding. */
+static int accepts(const char *accept, const char *coding)
+{
+    const char *p = accept, *q, *end;
+    size_t n = strlen(coding), len;
+    double qval;
+    int star = 0;
+
+    if (p == NULL)
+        return 0;
+    while (*p) {
+        p += strspn(p, " \t,");
+        if (*p == '\0')
+            break;
+        len = strcspn(p, " \t,;");
+        end = p + strcspn(p, ",");
+        qval = 1.0;
+        for (q = p + len; q < end; q++) {
+            if (*q == ';') {
+                q += strspn(q + 1, " \t");
+                if ((q[1] == 'q' || q[1] == 'Q') && q[2] == '=')
+                    qval = strtod(q + 3, NULL);
+            }
+        }
+        if (len == n && strncasecmp(p, coding, n) == 0)
+            return (qval > 0);
+        if (len == 1 && *p == '*')
+            star = (qval > 0);
+        p = end;
+    }
+    return star;
+}
+
+/* Compress len bytes of data, in gzip format if gzip is true or zlib
+   format (HTTP "deflate") otherwise.  Returns a buffer allocated with
+   malloc, or NULL if the data can't be compressed (or get no smaller). */
+static unsigned char *compress_body(const char *data, size_t len, int gzip,
+                                    size_t *zlen)
+{
+    z_stream z;
+    unsigned char *out;
+    size_t bound;
+
+    memset(&z, 0, sizeof(z));
+    if (len > (uInt) -1
+        || deflateInit2(&z, RESPONSE_ZLEVEL, Z_DEFLATED, gzip ? 31 : 15, 8,
+                        Z_DEFAULT_STRATEGY) != Z_OK)
+        return NULL;
+    bound = deflateBound(&z, len);
+    if ((out = malloc(bound)) == NULL) {
+        deflateEnd(&z);
+        return NULL;
+    }
+    z.next_in = (unsigned char *) data;
+    z.avail_in = len;
+    z.next_out = out;
+    z.avail_out = bound;
+    if (deflate(&z, Z_FINISH) != Z_STREAM_END || z.total_out >= len) {
+        deflateEnd(&z);
+        free(out);
+        return NULL;
+    }
+    *zlen = z.total_out;
+    deflateEnd(&z);
+    return out;
+}
+
+/* Stream the current response (if on is true): rather than waiting
+   until the response is complete, response_flush() sends each part of it
+   as it is produced.  If on is false, response_flush() does nothing
+   (a process that is only producing part of the response, for example,
+   must not send anything itself). */
+void response_stream(int on)
+{
+    if (saved_stdout)
+        streaming = on;
+}
+
+/* Send the part of a streamed body that hasn't been sent yet, preceded by
+   the headers if they haven't been sent.  If finish is true, this is the
+   end of the body. */
+static void stream_body(int finish)
+{
+    unsigned char out[16384];
+    int flush = finish ? Z_FINISH : Z_SYNC_FLUSH;
+
+    if (!headers_sent) {
+        if (accepts(accept_enc, "gzip"))
+            stream_enc = "gzip";
+        else if (accepts(accept_enc, "deflate"))
+            stream_enc = "deflate";
+        memset(&stream_z, 0, sizeof(stream_z));
+        if (stream_enc && deflateInit2(&stream_z, RESPONSE_ZLEVEL, Z_DEFLATED,
+                                       stream_enc[0] == 'g' ? 31 : 15, 8,
+                                       Z_DEFAULT_STRATEGY) != Z_OK)
+            stream_enc = NULL;
+        response_header("Vary", "Accept-Encoding");
+        if (stream_enc)
+            response_header("Content-Encoding", stream_enc);
+        write_fn(headers, headers_len);
+        write_fn("\r\n", 2);
+        headers_sent = 1;
+    }
+
+    if (stream_enc) {
+        stream_z.next_in = (unsigned char *) body + body_sent;
+        stream_z.avail_in = body_len - body_sent;
+        do {
+            stream_z.next_out = out;
+            stream_z.avail_out = sizeof(out);
+            deflate(&stream_z, flush);
+            write_fn(out, sizeof(out) - stream_z.avail_out);
+        } while (stream_z.avail_out == 0);
+        if (finish)
+            deflateEnd(&stream_z);
+    }
+    else
+        write_fn(body + body_sent, body_len - body_sent);
+    body_sent = body_len;
+    if (write_fn == write_stdout)
+        fflush(saved_stdout ? saved_stdout : stdout);
+
+    /* Discard what has been sent, and write the rest of the body from
+       the start of the buffer. */
+    if (!finish) {
+        body_base += body_len;
+        fseek(stdout, 0, SEEK_SET);
+        fflush(stdout);
+        body_sent = 0;
+    }
+}
+
+/* If the current response is being streamed, and at least RESPONSE_CHUNK
+   bytes of the body haven't been sent yet, send them. */
+void response_flush(void)
+{
+    if (!streaming || not_modified || saved_stdout == NULL)
+        return;
+    fflush(stdout);
+    if (body_len - body_sent >= RESPONSE_CHUNK)
+        stream_body(0);
+}
+
+/* Send the headers and the complete body of the current response. */
+static void send_body(void)
+{
+    const char *encoding = NULL;
+    unsigned char *zbody = NULL;
+    size_t zlen = 0;
+    char length[32];
+
+    if (body_len >= RESPONSE_MINZIP) {
+        if (accepts(accept_enc, "gzip"))
+            encoding = "gzip";
+        else if (accepts(accept_enc, "deflate"))
+            encoding = "deflate";
+        if (encoding && (zbody = compress_body(body, body_len,
+                                               encoding[0] == 'g',
+                                               &zlen)) == NULL)
+            encoding = NULL;
+    }
+
+    response_header("Vary", "Accept-Encoding");
+    if (encoding)
+        response_header("Content-Encoding", encoding);
+    snprintf(length, sizeof(length), "%lu",
+             (unsigned long) (zbody ? zlen : body_len));
+    response_header("Content-Length", length);
+
+    write_fn(headers, headers_len);
+    write_fn("\r\n", 2);
+    if (zbody)
+        write_fn(zbody, zlen);
+    else
+        write_fn(body, body_len);
+    free(zbody);
+}
+
+/* Finish the current response, and send it (or the rest of it, if it is
+   being streamed). */
+void response_end(void)
+{
+    if (saved_stdout == NULL)
+        return;
+    fclose(stdout);
+    stdout = saved_stdout;
+    saved_stdout = NULL;
+
+    if (not_modified) {
+        response_header("Vary", "Accept-Encoding");
+        write_fn("Status: 304 Not Modified\r\n", 26);
+        write_fn(headers, headers_len);
+        write_fn("\r\n", 2);
+    }
+    else if (headers_sent)
+        stream_body(1);
+    else
+        /* Not streamed (or streamed, but short enough that nothing has
+           been sent yet). */
+        send_body();
+    if (write_fn == write_stdout)
+        fflush(stdout);
+    free(body);
+    body = NULL;
+    body_len = 0;
+}
@@ -0,0 +1,47 @@
+/* file: response.h	B. Moody	18 October 2026
+
+Buffered and compressed responses for the LightWAVE server
+Copyright (C) 2026 Benjamin Moody
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIGHTWAVE_RESPONSE_H
+#define LIGHTWAVE_RESPONSE_H
+
+#include <stddef.h>
+#include <time.h>
+
+/* Responses smaller than this (in bytes) are never compressed. */
+#define RESPONSE_MINZIP 256
+
+/* zlib compression level (1 = fastest, 9 = smallest). */
+#define RESPONSE_ZLEVEL 6
+
+/* A streamed response is sent in parts of at least this many bytes. */
+#define RESPONSE_CHUNK 16384
+
+int response_begin(const char *accept_encoding,
+                   void (*out_fn)(const void *data, size_t len));
+void response_header(const char *name, const char *value);
+size_t response_tell(void);
+const char *response_body(size_t start, size_t *len);
+int response_validate(const char *etag, time_t last_modified,
+                      const char *if_none_match,
+                      const char *if_modified_since);
+void response_stream(int on);
+void response_flush(void);
+void response_end(void);
+
+#endif
@@ -1,5 +1,5 @@
 /* file: sandbox.c	B. Moody	22 February 2019
-			Last revised:	  26 July 2023     version 0.72
+			Last revised:	 18 October 2026   version 0.72
 
 Simple sandbox for the LightWAVE server
 Copyright (C) 2019 Benjamin Moody
@@ -29,9 +29,13 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <sys/mman.h>
 #include <sys/resource.h>
 #include <sys/prctl.h>
+#include <sys/wait.h>
 #include <sched.h>
 #include <signal.h>
 #include <seccomp.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include "sandbox.h"
 
 #ifndef SYS_SECCOMP
 # define SYS_SECCOMP 1
@@ -46,6 +50,18 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
         abort();                                                     \
     } while (0)
 
+/* SANDBOX_POOL is the default number of idle children kept waiting for
+   requests by lightwave_sandbox_zygote(); it can be changed at run time
+   by setting $LIGHTWAVE_POOL. */
+#ifndef SANDBOX_POOL
+#define SANDBOX_POOL 4
+#endif
+
+/* state saved by the zygote for use by its children */
+static char *calbuf;            /* contents of $LIGHTWAVE_WFDBCAL */
+static size_t calsize;
+static struct sock_fprog filter;  /* pre-compiled seccomp filter */
+
 static void set_hard_rlimit(int resource, rlim_t value)
 {
     struct rlimit rlim;
@@ -103,14 +119,17 @@ static void handle_sigsys(int signum, siginfo_t *info, void *context0)
     raise(signum);
 }
 
-void lightwave_sandbox()
+/* Perform the parts of the sandbox setup that don't depend on the
+   request: chroot, drop privileges and capabilities, and set resource
+   limits.  If zygote is true, the calibration file is read into memory
+   for later use by lightwave_sandbox_enter(), rather than replacing
+   stdin (which is the FastCGI listening socket.) */
+static void sandbox_prepare(int zygote)
 {
     uid_t effectiveuid = geteuid();
     uid_t realuid = getuid();
     gid_t realgid = getgid();
     char *rootdir, *dbcalfile;
-    struct sigaction sa;
-    scmp_filter_ctx ctx;
     cap_t no_capabilities;
 
     /* chdir and chroot into $LIGHTWAVE_ROOT, so only files in that
@@ -132,7 +151,21 @@ void lightwave_sandbox()
     /* If $LIGHTWAVE_WFDBCAL is set, use it as the path to a
        calibration file stored outside the root directory. */
     dbcalfile = getenv("LIGHTWAVE_WFDBCAL");
-    if (dbcalfile) {
+    if (dbcalfile && zygote) {
+        FILE *calfile = fopen(dbcalfile, "r");
+        size_t n;
+        if (!calfile)
+            FAILERR("cannot read $LIGHTWAVE_WFDBCAL");
+        do {
+            if (!(calbuf = realloc(calbuf, calsize + 4096)))
+                FAIL("out of memory");
+            n = fread(calbuf + calsize, 1, 4096, calfile);
+            calsize += n;
+        } while (n > 0);
+        fclose(calfile);
+        setenv("WFDBCAL", "-", 1);
+    }
+    else if (dbcalfile) {
         if (!freopen(dbcalfile, "r", stdin))
             FAILERR("cannot read $LIGHTWAVE_WFDBCAL");
         setenv("WFDBCAL", "-", 1);
@@ -163,22 +196,35 @@ void lightwave_sandbox()
     if (prctl(PR_SET_NO_NEW_PRIVS, 1UL, 0UL, 0UL, 0UL) != 0)
         FAILERR("cannot set no-new-privs");
 
-    /* resource limits */
+    /* resource limits (RLIMIT_CPU is set by sandbox_limit_cpu, since
+       in the zygote it should apply to each child but not to the parent) */
     set_hard_rlimit(RLIMIT_CORE, 0);
     set_hard_rlimit(RLIMIT_FSIZE, 0);
     set_hard_rlimit(RLIMIT_SIGPENDING, 256);
     set_hard_rlimit(RLIMIT_MEMLOCK, 1024 * 1024);
     set_hard_rlimit(RLIMIT_NOFILE, 256);
     set_hard_rlimit(RLIMIT_MSGQUEUE, 0);
-    set_hard_rlimit(RLIMIT_CPU, 60);
     set_hard_rlimit(RLIMIT_NPROC, 1000);
     set_hard_rlimit(RLIMIT_AS, 512 * 1024 * 1024);
+}
+
+static void sandbox_limit_cpu(void)
+{
+    struct sigaction sa;
+
+    set_hard_rlimit(RLIMIT_CPU, 60);
 
     /* handle SIGSYS by displaying an error message and exiting */
     sa.sa_sigaction = &handle_sigsys;
     sigemptyset(&sa.sa_mask);
     sa.sa_flags = SA_SIGINFO;
     sigaction(SIGSYS, &sa, NULL);
+}
+
+/* Construct the seccomp filter (this doesn't activate it.) */
+static scmp_filter_ctx sandbox_filter(void)
+{
+    scmp_filter_ctx ctx;
 
     /* all system calls not whitelisted below will raise SIGSYS */
     if ((ctx = seccomp_init(SCMP_ACT_TRAP)) == NULL)
@@ -226,7 +272,118 @@ void lightwave_sandbox()
          SCMP_A2(SCMP_CMP_MASKED_EQ, ~(PROT_READ | PROT_WRITE), 0),
          SCMP_A3(SCMP_CMP_EQ, (MAP_ANONYMOUS | MAP_PRIVATE)));
 
+    /* permit mmap(..., PROT_READ, MAP_SHARED, fd, ...)
+       (used by sigread.c to read signal files without copying them;
+       since files can only be opened read-only, and mprotect is not
+       permitted, such a mapping can never be written) */
+    seccomp_rule_add_exact
+        (ctx, SCMP_ACT_ALLOW, SCMP_SYS(mmap), 2,
+         SCMP_A2(SCMP_CMP_EQ, PROT_READ),
+         SCMP_A3(SCMP_CMP_EQ, MAP_SHARED));
+
+    /* permit posix_fadvise(fd, ..., POSIX_FADV_WILLNEED)
+       (used by sigread.c to start reading the next segment of a
+       multi-segment record before it is needed; this only asks the
+       kernel to read an open file into the page cache) */
+    seccomp_rule_add_exact
+        (ctx, SCMP_ACT_ALLOW, SCMP_SYS(fadvise64), 1,
+         SCMP_A3(SCMP_CMP_EQ, POSIX_FADV_WILLNEED));
+
+    return ctx;
+}
+
+void lightwave_sandbox()
+{
+    scmp_filter_ctx ctx;
+
+    sandbox_prepare(0);
+    sandbox_limit_cpu();
+
     /* activate the filter */
+    ctx = sandbox_filter();
     if (seccomp_load(ctx) != 0)
         FAIL("seccomp_load failed");
 }
+
+/* Prepare the sandbox once, then keep a pool of child processes waiting
+   for requests.  This function returns only in a child process (which
+   must call lightwave_sandbox_enter before handling any untrusted
+   input, and should exit after handling one request); the parent
+   process replaces each child as it exits, and runs until it is
+   killed.  Each child dies along with the parent. */
+void lightwave_sandbox_zygote()
+{
+    scmp_filter_ctx ctx;
+    pid_t parent, pid;
+    int fd, nchildren = 0, poolsize = SANDBOX_POOL;
+    char *p;
+    size_t n;
+
+    if ((p = getenv("LIGHTWAVE_POOL")) && atoi(p) > 0)
+        poolsize = atoi(p);
+
+    sandbox_prepare(1);
+
+    /* Compile the filter to BPF once, rather than in every child. */
+    ctx = sandbox_filter();
+    if ((fd = memfd_create("lightwave-seccomp", 0)) < 0)
+        FAILERR("cannot create memfd");
+    if (seccomp_export_bpf(ctx, fd) != 0)
+        FAIL("seccomp_export_bpf failed");
+    seccomp_release(ctx);
+    n = lseek(fd, 0, SEEK_CUR);
+    if (n == 0 || n % sizeof(struct sock_filter) != 0
+        || n / sizeof(struct sock_filter) > BPF_MAXINSNS)
+        FAIL("invalid seccomp filter");
+    if (!(filter.filter = malloc(n)))
+        FAIL("out of memory");
+    if (pread(fd, filter.filter, n, 0) != (ssize_t) n)
+        FAILERR("cannot read seccomp filter");
+    filter.len = n / sizeof(struct sock_filter);
+    close(fd);
+
+    parent = getpid();
+    for (;;) {
+        while (nchildren < poolsize) {
+            pid = fork();
+            if (pid == 0) {
+                if (prctl(PR_SET_PDEATHSIG, SIGTERM) != 0
+                    || getppid() != parent)
+                    _exit(1);
+                return;
+            }
+            if (pid < 0) {
+                perror("sandboxed-lightwave: cannot fork");
+                sleep(1);
+                break;
+            }
+            nchildren++;
+        }
+        if (waitpid(-1, NULL, 0) > 0)
+            nchildren--;
+    }
+}
+
+/* Complete the sandbox in a child of the zygote: set the CPU time
+   limit, supply the calibration file on stdin (replacing the listening
+   socket, which the child no longer needs), and activate the seccomp
+   filter that was compiled by the parent. */
+void lightwave_sandbox_enter()
+{
+    int fd;
+
+    if (calbuf) {
+        if ((fd = memfd_create("lightwave-wfdbcal", 0)) < 0
+            || write(fd, calbuf, calsize) != (ssize_t) calsize
+            || lseek(fd, 0, SEEK_SET) != 0
+            || dup2(fd, STDIN_FILENO) != STDIN_FILENO)
+            FAILERR("cannot copy $LIGHTWAVE_WFDBCAL");
+        close(fd);
+    }
+    else
+        close(STDIN_FILENO);
+
+    sandbox_limit_cpu();
+    if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &filter) != 0)
+        FAILERR("cannot load seccomp filter");
+}
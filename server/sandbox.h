@@ -31,6 +31,8 @@ static void lightwave_sandbox()
 }
 #else
 void lightwave_sandbox();
+void lightwave_sandbox_zygote();
+void lightwave_sandbox_enter();
 #endif
 
 #endif
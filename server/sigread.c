@@ -0,0 +1,877 @@
+/* file: sigread.c	B. Moody	18 October 2026
+
+Direct decoding of local signal files for the LightWAVE server
+Copyright (C) 2026 Benjamin Moody
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+getframe() decodes one sample at a time, choosing the decoder for each
+sample's format as it goes.  For the formats that nearly all PhysioNet
+records use (16, 61, 80, and 212), this module instead reads a block of
+frames from each signal file at once, and decodes it with a loop over
+the whole block that the compiler can vectorize.  The results are the
+same as getframe()'s: in particular, the smallest value that each format
+can represent (-32768, -128, or -2048) is returned as
+WFDB_INVALID_SAMPLE.
+
+Only the simplest records are handled this way: records whose signal
+files are local files (or remote files that can be read through the
+block cache; see blkcache.c), in one of those formats, with no skew,
+byte offset, or block size.  For anything else, sigread_open() returns
+NULL, and the caller uses getframe().  sigread_frames() decodes only
+frames that are complete in every signal file and within the length
+given by the header, so that the caller can also use getframe() for any
+frames after those (to get the library's behavior at the end of the
+record, whatever it is).
+
+The samples are decoded straight from a read-only mapping of the signal
+file, so that no copy of them is made, and so that processes reading the
+same record share the pages of the file in the page cache.  A mapping
+covers SIGREAD_MAPSIZE bytes or so around the samples that were asked
+for, and only the pages that hold those samples are touched; it is
+replaced when samples outside it are needed.  If a file can't be
+mapped, its samples are read into a buffer instead.  (Signal files are
+not expected to shrink while they are being read; if one does, reading
+the missing part of its mapping raises SIGBUS.)  Remote files, and
+their headers, are read through the block cache into a buffer in the
+same way.
+
+A multi-segment record is read one segment at a time.  When it is
+opened, the segments' names and lengths are read from its header, giving
+an index of the frame at which each segment begins, so that the segment
+containing any frame can be found without reading the other segments'
+headers.  A segment's own header is read when its frames are first
+needed; at the same time, the header of the following segment is read,
+its signal files are opened, and the kernel is asked to start reading
+the beginning of them (see prefetch()), so that a reader moving forward
+through the record usually finds the next segment ready when it gets
+there.  Only those two segments are kept open at a time.  Frames in
+null segments ("~") are returned as WFDB_INVALID_SAMPLE, as by
+getframe().  Frames in a segment that can't be decoded directly (for
+example, because its signals differ from those of the record) are left
+to the caller.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "blkcache.h"
+#include "sigread.h"
+
+struct sig_group {
+    int fd;                     /* -1 if the file is remote */
+    BLKFILE *bf;                /* the remote file, or NULL if local */
+    int fmt;
+    int spf;                    /* samples of the group in each frame */
+    int first;                  /* index of its first sample in a frame */
+    long long size;             /* size of the file in bytes */
+    unsigned char *map;         /* mapped part of the file, or NULL */
+    long long map_off;          /* offset of the mapped part */
+    size_t map_len;             /* length of the mapped part */
+};
+
+struct segment {
+    char *name;                 /* segment name, or NULL if null ("~") */
+    long long start;            /* first frame of the segment */
+    long long nframes;          /* length of the segment in frames */
+    SIGREAD *r;                 /* reader for the segment, if open */
+    int state;                  /* 0 if not yet opened, 1 if open, or -1
+                                   if it can't be decoded directly */
+};
+
+struct sigread {
+    int ngroups;
+    long pagesize;
+    int framelen;               /* samples in each frame (all groups) */
+    struct sig_group *g;
+    long long nframes;          /* number of frames that can be decoded */
+    unsigned char *buf;         /* bytes read from a file that isn't mapped */
+    size_t bufsize;
+    WFDB_Sample *tmp;           /* samples of one group, if there are more */
+    size_t tmpsize;
+
+    /* for a multi-segment record */
+    int nseg;
+    struct segment *seg;
+    int cur;                    /* segment last read */
+    char *dir;                  /* directory containing the headers */
+    int nsig;
+    int *spf, *baseline;        /* signal information for the record */
+    double *gain;
+    char **desc;                /* descriptions, if the record has a layout
+                                   segment (otherwise NULL) */
+};
+
+/* What sigread needs to know from a header: the lengths and names of the
+   segments of a multi-segment record, or the file names and formats of
+   the signals of an ordinary record (and their gains and baselines, to
+   compare with those of a multi-segment record). */
+struct hea_sig {
+    char fname[256];
+    int fmt, spf, baseline;
+    int simple;                 /* true if there's no skew or byte offset */
+    double gain;
+    char desc[256];             /* description, or "" if none */
+};
+
+struct header {
+    int nsig, nseg;
+    long long nsamp;
+    struct hea_sig *sig;
+    struct segment *seg;
+};
+
+/* A signal to be read directly: its file, format, samples per frame, and
+   group (signals in the same group are consecutive, and share a file and
+   a format). */
+struct sig_desc {
+    const char *path;
+    int fmt, spf, group;
+};
+
+static void free_header(struct header *h)
+{
+    int i;
+
+    for (i = 0; h->seg && i < h->nseg; i++)
+        free(h->seg[i].name);
+    free(h->seg);
+    free(h->sig);
+}
+
+/* Open a header file for reading: a local file directly, or a remote
+   one by reading it through the block cache into *buf (which the caller
+   must free after closing the file). */
+static FILE *open_header(const char *hea, char **buf)
+{
+    BLKFILE *bf;
+    long long size;
+    FILE *f = NULL;
+
+    *buf = NULL;
+    if (strstr(hea, "://") == NULL)
+        return fopen(hea, "r");
+    if ((bf = blkcache_open(hea)) == NULL)
+        return NULL;
+    size = blkcache_size(bf);
+    if (size > 0 && size < 1024 * 1024 && (*buf = malloc(size))
+        && blkcache_read(bf, 0, *buf, size) == 0)
+        f = fmemopen(*buf, size, "r");
+    blkcache_close(bf);
+    if (f == NULL) {
+        free(*buf);
+        *buf = NULL;
+    }
+    return f;
+}
+
+/* Read the header file hea into h.  Returns 0 if successful, or -1 if
+   it can't be read or doesn't make sense. */
+static int parse_header(const char *hea, struct header *h)
+{
+    FILE *f;
+    char line[1024], a[256], b[256], c[256], *p, *buf;
+    int n = -1, nf, k;
+    long long x, adczero, bsize;
+    struct hea_sig *sg;
+
+    memset(h, 0, sizeof(*h));
+    if ((f = open_header(hea, &buf)) == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), f)) {
+        if ((nf = sscanf(line, " %255s %255s %255s %lld", a, b, c, &x)) < 1
+            || a[0] == '#')
+            continue;
+        if (n < 0) {            /* record line */
+            if (nf < 2)
+                break;
+            h->nsig = atoi(b);
+            h->nsamp = (nf >= 4) ? x : 0;
+            if ((p = strchr(a, '/')) && (h->nseg = atoi(p + 1)) < 1)
+                break;
+            if (h->nsig < 0 || h->nsig > 100000 || h->nseg > 1000000)
+                break;
+            if (h->nseg > 0) {
+                if ((h->seg = calloc(h->nseg, sizeof(struct segment))) == NULL)
+                    break;
+            }
+            else if ((h->sig = calloc(h->nsig + 1, sizeof(struct hea_sig)))
+                     == NULL)
+                break;
+            n = 0;
+        }
+        else if (h->nseg > 0) { /* segment line */
+            if (nf < 2)
+                break;
+            if (strcmp(a, "~") != 0 && (h->seg[n].name = strdup(a)) == NULL)
+                break;
+            h->seg[n].nframes = atoll(b);
+            if (++n == h->nseg)
+                break;
+        }
+        else {                  /* signal line */
+            if (nf < 2)
+                break;
+            sg = &h->sig[n];
+            strcpy(sg->fname, a);
+            sg->fmt = strtol(b, &p, 10);
+            sg->spf = (*p == 'x') ? strtol(p + 1, &p, 10) : 1;
+            sg->simple = (*p == '\0');
+            sg->gain = (nf >= 3) ? strtod(c, &p) : 0;
+            sg->baseline = (nf >= 3 && *p == '(') ? atoi(p + 1) : 0;
+            adczero = bsize = 0;
+            sscanf(line, " %*s %*s %*s %*s %lld %*s %*s %lld",
+                   &adczero, &bsize);
+            if (nf < 3 || *p != '(')
+                sg->baseline = adczero;
+            if (sg->gain == 0)  /* as in the WFDB library */
+                sg->gain = WFDB_DEFGAIN;
+            if (bsize != 0)
+                sg->simple = 0;
+            k = -1;
+            sscanf(line, " %*s %*s %*s %*s %*s %*s %*s %*s %n", &k);
+            if (k > 0) {
+                strncpy(sg->desc, line + k, sizeof(sg->desc) - 1);
+                sg->desc[strcspn(sg->desc, "\r\n")] = '\0';
+            }
+            if (++n == h->nsig)
+                break;
+        }
+    }
+    fclose(f);
+    free(buf);
+    if (n >= 0 && n == (h->nseg > 0 ? h->nseg : h->nsig))
+        return 0;
+    free_header(h);
+    return -1;
+}
+
+/* Return the number of complete samples in a signal file of the given
+   format and size. */
+static long long file_samples(int fmt, long long size)
+{
+    switch (fmt) {
+    case 16:
+    case 61:
+        return size / 2;
+    case 80:
+        return size;
+    case 212:
+        return (size / 3) * 2 + (size % 3 == 2);
+    }
+    return 0;
+}
+
+/* Return the offset of the byte containing (the start of) sample i of a
+   signal file of the given format. */
+static long long sample_offset(int fmt, long long i)
+{
+    switch (fmt) {
+    case 16:
+    case 61:
+        return 2 * i;
+    case 80:
+        return i;
+    case 212:
+        return i / 2 * 3 + i % 2;
+    }
+    return 0;
+}
+
+static SIGREAD *new_reader(void)
+{
+    SIGREAD *r;
+
+    if ((r = calloc(1, sizeof(SIGREAD))) == NULL)
+        return NULL;
+    if ((r->pagesize = sysconf(_SC_PAGESIZE)) < 1)
+        r->pagesize = 4096;
+    return r;
+}
+
+/* Open the signal files described by d, and return a reader for them
+   (reading no more than nframes frames, if nframes is positive), or
+   NULL if they can't be read directly. */
+static SIGREAD *open_files(const struct sig_desc *d, int nsig,
+                           long long nframes)
+{
+    SIGREAD *r;
+    struct sig_group *g = NULL;
+    long long nf;
+    int n;
+
+    for (n = 0; n < nsig; n++)
+        if (d[n].path == NULL || d[n].spf < 1
+            || (d[n].fmt != 16 && d[n].fmt != 61 && d[n].fmt != 80
+                && d[n].fmt != 212))
+            return NULL;
+    if ((r = new_reader()) == NULL)
+        return NULL;
+    r->nframes = (nframes > 0) ? nframes : -1;
+
+    for (n = 0; n < nsig; n++) {
+        if (n > 0 && d[n].group == d[n-1].group) {
+            if (d[n].fmt != g->fmt || strcmp(d[n].path, d[n-1].path) != 0)
+                goto fail;
+            g->spf += d[n].spf;
+        }
+        else {
+            if ((g = realloc(r->g, (r->ngroups + 1) * sizeof(*g))) == NULL)
+                goto fail;
+            r->g = g;
+            g += r->ngroups++;
+            g->fmt = d[n].fmt;
+            g->spf = d[n].spf;
+            g->first = r->framelen;
+            g->map = NULL;
+            g->bf = NULL;
+            g->fd = -1;
+            if (strstr(d[n].path, "://"))
+                g->bf = blkcache_open(d[n].path);
+            else
+                g->fd = open(d[n].path, O_RDONLY);
+            if (g->fd < 0 && g->bf == NULL) {
+                r->ngroups--;
+                goto fail;
+            }
+        }
+        r->framelen += d[n].spf;
+    }
+
+    /* Decode only frames that are complete in every file.  (The size of
+       a local file is found with lseek rather than fstat, since the
+       sandbox doesn't allow the newfstatat call that glibc uses for
+       fstat; see sandbox.c.) */
+    for (n = 0; n < r->ngroups; n++) {
+        g = &r->g[n];
+        if (g->bf)
+            g->size = blkcache_size(g->bf);
+        else if ((g->size = lseek(g->fd, 0, SEEK_END)) < 0)
+            goto fail;
+        nf = file_samples(g->fmt, g->size) / g->spf;
+        if (r->nframes < 0 || nf < r->nframes)
+            r->nframes = nf;
+    }
+    return r;
+
+ fail:
+    sigread_close(r);
+    return NULL;
+}
+
+/* Prepare to read a multi-segment record, given its header h (whose
+   segment list is taken over by the reader). */
+static SIGREAD *open_multi(const char *hea, struct header *h,
+                           const WFDB_Siginfo *s, int nsig)
+{
+    SIGREAD *r;
+    const char *p;
+    long long t = 0;
+    int i;
+
+    if ((r = new_reader()) == NULL)
+        return NULL;
+    r->nseg = h->nseg;
+    r->seg = h->seg;
+    h->seg = NULL;
+    for (i = 0; i < r->nseg; i++) {
+        r->seg[i].start = t;
+        t += r->seg[i].nframes;
+    }
+    r->nframes = t;
+    r->cur = -1;
+
+    /* The segments' headers are in the same directory as the record's. */
+    p = strrchr(hea, '/');
+    r->nsig = nsig;
+    r->dir = calloc(p ? p - hea + 2 : 1, 1);
+    r->spf = calloc(nsig, sizeof(int));
+    r->baseline = calloc(nsig, sizeof(int));
+    r->gain = calloc(nsig, sizeof(double));
+    if (r->dir == NULL || r->spf == NULL || r->baseline == NULL
+        || r->gain == NULL) {
+        sigread_close(r);
+        return NULL;
+    }
+    if (p)
+        memcpy(r->dir, hea, p - hea + 1);
+
+    /* If the first segment is a layout segment, the WFDB library matches
+       the signals of each segment with those of the record by their
+       descriptions; otherwise, by their order. */
+    if (r->nseg > 1 && r->seg[0].nframes == 0) {
+        if ((r->desc = calloc(nsig, sizeof(char *))) == NULL) {
+            sigread_close(r);
+            return NULL;
+        }
+        for (i = 0; i < nsig; i++)
+            if ((r->desc[i] = strdup(s[i].desc ? s[i].desc : "")) == NULL) {
+                sigread_close(r);
+                return NULL;
+            }
+    }
+    for (i = 0; i < nsig; i++) {
+        r->framelen += s[i].spf;
+        r->spf[i] = s[i].spf;
+        r->baseline[i] = s[i].baseline;
+        r->gain[i] = (s[i].gain == 0) ? WFDB_DEFGAIN : s[i].gain;
+    }
+    return r;
+}
+
+/* Prepare to decode the signals of a record directly.  hea is the
+   pathname of the record's header, and (unless it is a multi-segment
+   record) path[n] is that of the file containing signal n.  Returns NULL
+   if the record can't be decoded in this way. */
+SIGREAD *sigread_open(const char *hea, const WFDB_Siginfo *s, int nsig,
+                      char **path)
+{
+    SIGREAD *r = NULL;
+    struct header h;
+    struct sig_desc *d;
+    int n;
+
+    if (hea == NULL || nsig < 1 || parse_header(hea, &h) != 0)
+        return NULL;
+    if (h.nseg > 0)
+        r = open_multi(hea, &h, s, nsig);
+    else if (path && h.nsig == nsig
+             && (d = calloc(nsig, sizeof(struct sig_desc)))) {
+        for (n = 0; n < nsig; n++) {
+            if (!h.sig[n].simple || s[n].bsize != 0)
+                break;
+            d[n].path = path[n];
+            d[n].fmt = s[n].fmt;
+            d[n].spf = s[n].spf;
+            d[n].group = s[n].group;
+        }
+        if (n == nsig)
+            r = open_files(d, nsig, s[0].nsamp);
+        free(d);
+    }
+    free_header(&h);
+    return r;
+}
+
+/* Open segment i of a multi-segment record, if it isn't already open.
+   Returns its reader, or NULL if it can't be decoded directly. */
+static SIGREAD *open_segment(SIGREAD *r, int i)
+{
+    struct segment *sg = &r->seg[i];
+    struct header h;
+    struct sig_desc *d = NULL;
+    char *hea = NULL, **path = NULL;
+    int n;
+
+    if (sg->state)
+        return sg->r;
+    sg->state = -1;
+    if (sg->name == NULL
+        || (hea = malloc(strlen(r->dir) + strlen(sg->name) + 5)) == NULL)
+        return NULL;
+    sprintf(hea, "%s%s.hea", r->dir, sg->name);
+    if (parse_header(hea, &h) != 0) {
+        free(hea);
+        return NULL;
+    }
+
+    /* Samples are returned as they are, so the segment's signals must be
+       the same as the record's. */
+    if (h.nseg == 0 && h.nsig == r->nsig
+        && (d = calloc(h.nsig, sizeof(struct sig_desc)))
+        && (path = calloc(h.nsig, sizeof(char *)))) {
+        for (n = 0; n < h.nsig; n++) {
+            struct hea_sig *hs = &h.sig[n];
+
+            if (!hs->simple || hs->spf != r->spf[n] || hs->gain != r->gain[n]
+                || hs->baseline != r->baseline[n]
+                || (r->desc && strcmp(hs->desc, r->desc[n]) != 0)
+                || strcmp(hs->fname, "~") == 0 || strcmp(hs->fname, "-") == 0
+                || (path[n] = malloc(strlen(r->dir) + strlen(hs->fname) + 1))
+                   == NULL)
+                break;
+            sprintf(path[n], "%s%s", r->dir, hs->fname);
+            d[n].path = path[n];
+            d[n].fmt = hs->fmt;
+            d[n].spf = hs->spf;
+            d[n].group = (n > 0 && strcmp(hs->fname, h.sig[n-1].fname) == 0)
+                ? d[n-1].group : n;
+        }
+        if (n == h.nsig && (sg->r = open_files(d, n, sg->nframes)))
+            sg->state = 1;
+        while (--n >= 0)
+            free(path[n]);
+    }
+    free(path);
+    free(d);
+    free(hea);
+    free_header(&h);
+    return sg->r;
+}
+
+/* Ask the kernel to start reading the first SIGREAD_MAPSIZE bytes of
+   each of a reader's signal files, without waiting for them. */
+static void prefetch(SIGREAD *r)
+{
+    int n;
+
+    for (n = 0; n < r->ngroups; n++)
+        if (r->g[n].fd >= 0)
+            posix_fadvise(r->g[n].fd, 0, SIGREAD_MAPSIZE,
+                          POSIX_FADV_WILLNEED);
+}
+
+/* Read frames from a multi-segment record (see sigread_frames). */
+static long multi_frames(SIGREAD *r, WFDB_Time t, long n, WFDB_Sample *v)
+{
+    struct segment *sg;
+    long done = 0, k, m;
+    int i, lo, hi, j;
+
+    while (done < n && t + done < r->nframes) {
+        /* Find the segment containing frame t + done. */
+        for (lo = 0, hi = r->nseg - 1; lo < hi; ) {
+            i = (lo + hi + 1) / 2;
+            if (r->seg[i].start <= t + done)
+                lo = i;
+            else
+                hi = i - 1;
+        }
+        sg = &r->seg[lo];
+        m = sg->start + sg->nframes - (t + done);
+        if (m > n - done)
+            m = n - done;
+
+        /* Moving to another segment: close any others (except the next
+           one), and prepare the next one. */
+        if (lo != r->cur) {
+            r->cur = lo;
+            for (j = 0; j < r->nseg; j++)
+                if (r->seg[j].state && j != lo && j != lo + 1) {
+                    sigread_close(r->seg[j].r);
+                    r->seg[j].r = NULL;
+                    r->seg[j].state = 0;
+                }
+            if (lo + 1 < r->nseg && !r->seg[lo+1].state
+                && open_segment(r, lo + 1))
+                prefetch(r->seg[lo+1].r);
+        }
+
+        if (sg->name == NULL) {
+            for (k = 0; k < m * r->framelen; k++)
+                v[done * r->framelen + k] = WFDB_INVALID_SAMPLE;
+            k = m;
+        }
+        else if (open_segment(r, lo) == NULL)
+            break;
+        else
+            k = sigread_frames(sg->r, t + done - sg->start, m,
+                               v + done * r->framelen);
+        done += k;
+        if (k < m)
+            break;
+    }
+    return done;
+}
+
+void sigread_close(SIGREAD *r)
+{
+    int n;
+
+    if (r == NULL)
+        return;
+    for (n = 0; n < r->nseg; n++) {
+        sigread_close(r->seg[n].r);
+        free(r->seg[n].name);
+    }
+    free(r->seg);
+    free(r->dir);
+    free(r->spf);
+    free(r->baseline);
+    free(r->gain);
+    for (n = 0; r->desc && n < r->nsig; n++)
+        free(r->desc[n]);
+    free(r->desc);
+    for (n = 0; n < r->ngroups; n++) {
+        if (r->g[n].map)
+            munmap(r->g[n].map, r->g[n].map_len);
+        if (r->g[n].bf)
+            blkcache_close(r->g[n].bf);
+        else
+            close(r->g[n].fd);
+    }
+    free(r->g);
+    free(r->buf);
+    free(r->tmp);
+    free(r);
+}
+
+/* Return a pointer to len bytes from offset off of the signal file of
+   group g: either within its mapping (which is moved if necessary), or,
+   if the file can't be mapped, in r->buf.  Returns NULL if the bytes
+   can't be read. */
+static const unsigned char *get_bytes(SIGREAD *r, struct sig_group *g,
+                                      long long off, size_t len)
+{
+    unsigned char *p;
+    long long start, end;
+    ssize_t k;
+
+    if (g->map && off >= g->map_off
+        && off + (long long) len <= g->map_off + (long long) g->map_len)
+        return g->map + (off - g->map_off);
+
+    if (g->map) {
+        munmap(g->map, g->map_len);
+        g->map = NULL;
+    }
+    start = off - off % r->pagesize;
+    end = start + SIGREAD_MAPSIZE;
+    if (end < off + (long long) len)
+        end = off + len;
+    if (end > g->size)
+        end = g->size;
+    if (end > start && g->fd >= 0) {
+        p = mmap(NULL, end - start, PROT_READ, MAP_SHARED, g->fd, start);
+        if (p != MAP_FAILED) {
+            g->map = p;
+            g->map_off = start;
+            g->map_len = end - start;
+            if (off + (long long) len <= end)
+                return g->map + (off - start);
+        }
+    }
+
+    if (len > r->bufsize) {
+        if ((p = realloc(r->buf, len)) == NULL)
+            return NULL;
+        r->buf = p;
+        r->bufsize = len;
+    }
+    if (g->bf)
+        return (blkcache_read(g->bf, off, r->buf, len) == 0 ? r->buf : NULL);
+    if (lseek(g->fd, off, SEEK_SET) != off)
+        return NULL;
+    for (p = r->buf; len > 0; p += k, len -= k)
+        if ((k = read(g->fd, p, len)) <= 0)
+            return NULL;
+    return r->buf;
+}
+
+/* The decoders: each converts n samples from b to x.  The loops are kept
+   simple (no branches, and one output per iteration where possible) so
+   that the compiler can vectorize them. */
+static void decode_16(const unsigned char *b, long n, WFDB_Sample *x)
+{
+    long i;
+
+    for (i = 0; i < n; i++)
+        x[i] = (short) (b[2*i] | b[2*i+1] << 8);
+    for (i = 0; i < n; i++)
+        x[i] = (x[i] == -32768) ? WFDB_INVALID_SAMPLE : x[i];
+}
+
+static void decode_61(const unsigned char *b, long n, WFDB_Sample *x)
+{
+    long i;
+
+    for (i = 0; i < n; i++)
+        x[i] = (short) (b[2*i] << 8 | b[2*i+1]);
+    for (i = 0; i < n; i++)
+        x[i] = (x[i] == -32768) ? WFDB_INVALID_SAMPLE : x[i];
+}
+
+static void decode_80(const unsigned char *b, long n, WFDB_Sample *x)
+{
+    long i;
+
+    for (i = 0; i < n; i++)
+        x[i] = b[i] - 128;
+    for (i = 0; i < n; i++)
+        x[i] = (x[i] == -128) ? WFDB_INVALID_SAMPLE : x[i];
+}
+
+/* Format 212 packs each pair of samples into three bytes; if odd is true,
+   the first sample to be decoded is the second of its pair. */
+static void decode_212(const unsigned char *b, int odd, long n, WFDB_Sample *x)
+{
+    WFDB_Sample *y = x;
+    long i, npairs;
+
+    if (odd && n > 0) {
+        *y++ = (b[1] & 0xf0) << 4 | b[2];
+        b += 3;
+    }
+    npairs = (n - (y - x)) / 2;
+    for (i = 0; i < npairs; i++) {
+        y[2*i] = (b[3*i+1] & 0x0f) << 8 | b[3*i];
+        y[2*i+1] = (b[3*i+1] & 0xf0) << 4 | b[3*i+2];
+    }
+    if (y + 2*npairs < x + n)
+        y[2*npairs] = (b[3*npairs+1] & 0x0f) << 8 | b[3*npairs];
+    for (i = 0; i < n; i++)
+        x[i] = ((x[i] ^ 0x800) - 0x800 == -2048) ? WFDB_INVALID_SAMPLE
+            : (x[i] ^ 0x800) - 0x800;
+}
+
+/* Decode the n samples of group g starting at sample number i0 (counting
+   from the beginning of its file) into x.  Returns 0 if successful, or -1
+   if they can't be read. */
+static int decode_group(SIGREAD *r, struct sig_group *g, long long i0,
+                        long n, WFDB_Sample *x)
+{
+    const unsigned char *b;
+    long long b0, b1;
+
+    switch (g->fmt) {
+    case 16:
+    case 61:
+        if ((b = get_bytes(r, g, 2*i0, 2*(size_t)n)) == NULL)
+            return -1;
+        if (g->fmt == 16)
+            decode_16(b, n, x);
+        else
+            decode_61(b, n, x);
+        return 0;
+    case 80:
+        if ((b = get_bytes(r, g, i0, n)) == NULL)
+            return -1;
+        decode_80(b, n, x);
+        return 0;
+    case 212:
+        /* Read from the start of the first pair to the end of the last
+           sample (which may be the first of a pair, in the last two bytes
+           of the file). */
+        b0 = (i0 / 2) * 3;
+        b1 = ((i0 + n) / 2) * 3 + ((i0 + n) % 2 ? 2 : 0);
+        if ((b = get_bytes(r, g, b0, b1 - b0)) == NULL)
+            return -1;
+        decode_212(b, i0 % 2, n, x);
+        return 0;
+    }
+    return -1;
+}
+
+/* Decode up to n frames, starting with frame t, into v (which has room for
+   n frames, in the same order as getframe() would return them).  Returns
+   the number of frames decoded, which is less than n if the rest can't be
+   decoded directly. */
+long sigread_frames(SIGREAD *r, WFDB_Time t, long n, WFDB_Sample *v)
+{
+    struct sig_group *g;
+    size_t need;
+    long k;
+    int i;
+
+    if (r->nseg > 0)
+        return multi_frames(r, t, n, v);
+    if (t < 0 || t >= r->nframes)
+        return 0;
+    if (n > r->nframes - t)
+        n = r->nframes - t;
+    if (n <= 0)
+        return 0;
+
+    /* A record with a single group is decoded in place; otherwise each
+       group is decoded separately, and its samples are copied into each
+       frame. */
+    if (r->ngroups == 1)
+        return (decode_group(r, r->g, t * r->g->spf, n * r->g->spf, v) ? 0 : n);
+    need = (size_t) n * r->framelen;
+    if (need > r->tmpsize) {
+        WFDB_Sample *p = realloc(r->tmp, need * sizeof(WFDB_Sample));
+        if (p == NULL)
+            return 0;
+        r->tmp = p;
+        r->tmpsize = need;
+    }
+    for (i = 0; i < r->ngroups; i++) {
+        g = &r->g[i];
+        if (decode_group(r, g, t * g->spf, n * g->spf, r->tmp))
+            return 0;
+        for (k = 0; k < n; k++)
+            memcpy(v + k * r->framelen + g->first, r->tmp + k * g->spf,
+                   g->spf * sizeof(WFDB_Sample));
+    }
+    return n;
+}
+
+/* Prefetch n frames, starting with frame t (see sigread_prefetch),
+   fetching no more than *budget bytes of remote files, and subtracting
+   the number fetched from *budget. */
+static void prefetch_frames(SIGREAD *r, WFDB_Time t, long n,
+                            long long *budget)
+{
+    struct sig_group *g;
+    struct segment *sg;
+    long long off, end, a, b;
+    int i, was_open;
+
+    if (t < 0 || t >= r->nframes || n <= 0)
+        return;
+    if (n > r->nframes - t)
+        n = r->nframes - t;
+
+    /* In a multi-segment record, segments opened only for this purpose
+       are closed again afterwards. */
+    for (i = 0; i < r->nseg && *budget > 0; i++) {
+        sg = &r->seg[i];
+        if (sg->start + sg->nframes <= t || sg->start >= t + n
+            || sg->name == NULL)
+            continue;
+        was_open = sg->state;
+        if (open_segment(r, i) == NULL)
+            continue;
+        a = (t > sg->start ? t : sg->start);
+        b = (t + n < sg->start + sg->nframes ? t + n
+             : sg->start + sg->nframes);
+        prefetch_frames(sg->r, a - sg->start, b - a, budget);
+        if (!was_open && i != r->cur && i != r->cur + 1) {
+            sigread_close(sg->r);
+            sg->r = NULL;
+            sg->state = 0;
+        }
+    }
+
+    for (i = 0; i < r->ngroups; i++) {
+        g = &r->g[i];
+        off = sample_offset(g->fmt, t * g->spf);
+        end = sample_offset(g->fmt, (t + n) * g->spf) + 2;
+        if (end > g->size)
+            end = g->size;
+        if (g->bf == NULL)
+            posix_fadvise(g->fd, off, end - off, POSIX_FADV_WILLNEED);
+        else if (*budget > 0 && end > off) {
+            if (end - off > *budget)
+                end = off + *budget;
+            blkcache_prefetch(g->bf, off, end - off);
+            *budget -= end - off;
+        }
+    }
+}
+
+/* Prepare to read n frames, starting with frame t, soon: ask the kernel
+   to start reading the parts of local signal files that hold them, and
+   fetch the parts of remote files into the block cache.  Since the
+   latter waits for them to arrive, no more than SIGREAD_PREFETCHMAX
+   bytes of remote files (those nearest frame t) are fetched. */
+void sigread_prefetch(SIGREAD *r, WFDB_Time t, long n)
+{
+    long long budget = SIGREAD_PREFETCHMAX;
+
+    prefetch_frames(r, t, n, &budget);
+}
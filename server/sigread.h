@@ -0,0 +1,41 @@
+/* file: sigread.h	B. Moody	18 October 2026
+
+Direct decoding of local signal files for the LightWAVE server
+Copyright (C) 2026 Benjamin Moody
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LIGHTWAVE_SIGREAD_H
+#define LIGHTWAVE_SIGREAD_H
+
+#include <wfdb/wfdb.h>
+
+/* Size (in bytes) of the part of a signal file that is mapped at once
+   (more is mapped if a single read needs it). */
+#define SIGREAD_MAPSIZE	(16 * 1024 * 1024)
+
+/* Maximum number of bytes of remote signal files fetched into the block
+   cache by sigread_prefetch (which waits for them). */
+#define SIGREAD_PREFETCHMAX	(4 * 1024 * 1024)
+
+typedef struct sigread SIGREAD;
+
+SIGREAD *sigread_open(const char *hea, const WFDB_Siginfo *s, int nsig,
+                      char **path);
+long sigread_frames(SIGREAD *r, WFDB_Time t, long n, WFDB_Sample *v);
+void sigread_prefetch(SIGREAD *r, WFDB_Time t, long n);
+void sigread_close(SIGREAD *r);
+
+#endif